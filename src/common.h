@@ -9,16 +9,20 @@
  *   > LINEMAX
  *   > MIN/MAX(x, y)
  *   > HASH/HASHx()
- *   > randgen(max, G)
+ *   > randgen(max, G), randgen_seed(G, seed, stream)
+ *   > make_tuple(k, p), key_at(Sub, i), tuple_at(Sub, i), tuple_set(Sub, i, t)
+ *   > cpu_relax(), spin_relax()
  */
 
 #ifndef __COMMON_H__
   #define __COMMON_H__
 
   #include <stdint.h>
+  #include <stddef.h>
   #include <stdbool.h>
   #include <assert.h>
   #include <limits.h>
+  #include <sched.h>
 
   #include "util/sys_info.h"
   #include "types.h"
@@ -32,7 +36,9 @@
   /* Constants. */
   #define LINEMAX   4096
   #define TEST_KEY_INPLACEOF_PAYLOAD false
+  #define KEY_INPLACEOF_PAYLOAD (TEST_KEY_INPLACEOF_PAYLOAD || PAYLOAD_BYTES == 0)
   #define ChunkSize ((1 << 15) - 10)
+  #define MorselSize (1 << 14) // # of tuples of S per morsel (see morsel.c).
 
   #if ChunkSize < (1 << 16)
     typedef uint16_t counter_t;
@@ -50,6 +56,7 @@
   extern sys_info_t   SysInfo;   // Hardware Stats, etc.
   extern params_t     Threads;
   extern radix_info_t Radix;
+  extern __thread thread_t *CurrentThread; // Calling worker's Threads.Args.
 
   /*** Function Declarations. ***/
   // Running Threads.N threads, each passed its own Threads.Args.
@@ -65,8 +72,12 @@
 
   // Barriers.
   void barrier_init();
+  void barrier_cleanup();
   void barrier();
   void sbarrier(short tid);
+  void group_barrier(thread_t*); // Synchronizes one LLC group only.
+  void sbarrier_spin(short tid);
+  void barrier_benchmark();
 
   // Allocation.
   void* SafeMalloc(size_t);
@@ -74,12 +85,111 @@
   void* PageAlignedAlloc(size_t);
   void* CacheLineAlignedAlloc(size_t);
 
+  // NUMA-aware Allocation (see util/numa.c).
+  #define AllNodes UINT32_MAX // i.e., interleaved across utilized nodes.
+  void* NodeAlloc(size_t, uint32_t node);
+  void* InterleavedAlloc(size_t);
+  void  NodeFree(void*, size_t);
+  void  numa_bind_thread(uint32_t node);
+  void  numa_place(void*, size_t, uint32_t node);
+
+  // Per-thread Arena (see util/arena.c).
+  void*        ArenaAlloc(thread_t*, size_t);
+  arena_mark_t arena_mark(thread_t*);
+  void         arena_release(thread_t*, arena_mark_t);
+  void         arena_reserve(thread_t*, size_t);
+  void         arena_cleanup(thread_t*);
+
+  // Huge-page Allocation (see util/hugepage.c).
+  void* HugeAlloc(size_t, uint32_t node);
+  void  HugeFree(void*);
+  void  huge_reserve(size_t, uint32_t node);
+  void  huge_pages_report();
+  void  huge_pages_cleanup();
+
+  // Binary Relation Files.
+  void relfile_open(relation_t*);
+  void relfile_map(uint32_t tid, relation_t*, relation_t *Sub);
+  void relfile_unmap(relation_t *Sub);
+  bool relfile_write(relation_t*, char *path);
+  void textfile_open(relation_t*);
+  void textfile_load(uint32_t tid, relation_t*, relation_t *Sub);
+  void textfile_cleanup();
+  void relcache_prepare(relation_t*);
+  void relcache_store(relation_t*);
+  uint64_t generated_max_key();
+  void *rebase_keys(void*);
+  void sub_alloc(uint32_t tid, relation_t *Sub);
+
+  // Hardware Calibration (see util/calibrate.c).
+  void calibrate();
+  void profile_load();
+
+  // Cost-based Planning (see join/plan.c).
+  void     plan_join();
+  uint32_t plan_model_III_radix(double max_share);
+
+  // Morsel-driven Probing (of relation S).
+  void morsels_prepare(thread_t*);
+  bool morsel_next(thread_t*, morsel_iter_t*, relation_t**, uint32_t*,
+                   uint32_t*);
+  void morsels_cleanup(thread_t*);
+
   // Misc Math-related Functions.
   uint32_t lg_floor(uint32_t);
   uint32_t lg_ceil(uint32_t);
   uint32_t div_ceil(uint32_t, uint32_t);
 
 
+  /*** Inline Function Definitions: Spin-wait Hint. ***/
+  static inline void cpu_relax() {
+    #if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+    #else
+      __sync_synchronize();
+    #endif
+  }
+
+  /* Spin-wait step that yields the CPU to other workers if oversubscribed. */
+  static inline void spin_relax() {
+    if(Threads.oversubscribed) sched_yield();
+    else                       cpu_relax();
+  }
+
+
+  /*** Inline Function Definitions: Tuple Access. ***/
+  /* Tuple of key k and payload p (which key-only tuples drop). */
+  static inline tuple_t make_tuple(tkey_t k, tpayload_t p) {
+    #if PAYLOAD_BYTES > 0
+      return (tuple_t){k, p};
+    #else
+      (void)p; return (tuple_t){k};
+    #endif
+  }
+
+  /*
+   * Key (or tuple) at position i of Sub, in either layout: rows (`tuples`)
+   * or, with --columnar, columns (`keys`, `payloads`). The layout is fixed
+   * for a relation, so compilers hoist the test out of loops.
+   */
+  static inline tkey_t key_at(relation_t *Sub, uint32_t i) {
+    return Sub->tuples ? Sub->tuples[i].key : Sub->keys[i];
+  }
+
+  static inline tuple_t tuple_at(relation_t *Sub, uint32_t i) {
+    if(Sub->tuples) return Sub->tuples[i];
+    return make_tuple(Sub->keys[i], Sub->payloads[i]);
+  }
+
+  static inline void tuple_set(relation_t *Sub, uint32_t i, tuple_t t) {
+    if(Sub->tuples) { Sub->tuples[i] = t; return; }
+    Sub->keys[i] = t.key;
+    #if PAYLOAD_BYTES > 0
+      Sub->payloads[i] = t.payload;
+    #endif
+  }
+
+
   /*** Inline Function Definitions: Random Number Generator. ***/
   /* Link: https://en.wikipedia.org/wiki/Xorshift */
   static inline uint32_t xorshift128(randgen_t *G) {
@@ -92,6 +202,26 @@
       return G->w;
   }
 
+  /*
+   * Seeds G as stream `stream` of `seed`; distinct streams are independent,
+   * so work split into streams is reproducible regardless of who runs it.
+   * Link: https://prng.di.unimi.it/splitmix64.c
+   */
+  static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  static inline void randgen_seed(randgen_t *G, uint64_t seed, uint64_t stream) {
+    uint64_t state = seed ^ splitmix64(&stream);
+    uint64_t a = splitmix64(&state), b = splitmix64(&state);
+
+    G->w = (uint32_t)a; G->x = (uint32_t)(a >> 32);
+    G->y = (uint32_t)b; G->z = (uint32_t)(b >> 32) | 1; // Never all-zero.
+  }
+
   /* Link: http://funloop.org/post/2015-02-27-removing-modulo-bias-redux.html */
   static inline uint32_t randgen(uint32_t max, randgen_t *G) {
     uint32_t r;
@@ -19,68 +19,76 @@ void ColBP_I(thread_t* T) { assert(Radix.R == 0 && Radix.S == 0);
   global_timer_start(&phase_timer, tid);
 
   /* Allocate and NUMA-distribute shared Hash Table. */
-  uint32_t HTable_size = Threads.RelR->size + 1;
+  uint32_t HTable_size = Threads.max_key + 1;
 
   if(tid == 0) {
     Threads.HTables    = SafeMalloc(sizeof(bucket_t*));
-    Threads.HTables[0] = SafeMalloc(HTable_size * sizeof(bucket_t));
+    Threads.HTables[0] = HugeAlloc(HTable_size * sizeof(bucket_t), AllNodes);
   }
 
   barrier(); // Wait for allocation.
 
   bucket_t *HTable = Threads.HTables[0];
 
-  uint32_t share   = HTable_size / Threads.N;
+  uint32_t share  = HTable_size / Threads.N;
   uint32_t offset = tid * share;
+  if(tid == Threads.N - 1) share = HTable_size - offset; // And the remainder.
   memset(HTable + offset, 0, share * sizeof(bucket_t));
 
   barrier(); // Wait for NUMA distribution.
 
   /* Build HTable from R. */
-  tuple_t *R     = T->SubR->tuples;
-  uint32_t sizeR = T->SubR->size;
+  relation_t *R     = T->SubR;
+  uint32_t    sizeR = T->SubR->size;
 
   for(uint32_t i = 0; i < sizeR; i++) {
-    tuple_t t = R[i];
+    tuple_t t = tuple_at(R, i);
     tkey_t  k = t.key;
 
     /* Scatter, NOPA-style Array-based. */
-    #if !TEST_KEY_INPLACEOF_PAYLOAD
-      HTable[k] = t.payload;
+    assert(k <= Threads.max_key); // Bounded by the table (see relfile.c).
+    #if !KEY_INPLACEOF_PAYLOAD
+      HTable[k] = t.payload + 1;
     #else
-      HTable[k] = k;
+      HTable[k] = k + 1;
     #endif
 
     checksum += k;
   }
 
+  morsels_prepare(T); // Published by the barrier below.
+
   barrier(); // Wait for completely constructed table.
 
   global_timer_report(&phase_timer, tid, "#>> Total Building");
   global_timer_start(&phase_timer, tid);
 
 
-  /* Probe HTable from S. */
-  tuple_t *S     = T->SubS->tuples;
-  uint32_t sizeS = T->SubS->size;
-
-  for(uint32_t i = 0; i < sizeS; i++) {
-    tuple_t t = S[i];
-    tkey_t  k = t.key;
-
-    /*
-     * Gather, NOPA-style Array-based.
-     * For comparability with previous work (e.g., Balkesen et al., Kim et al.,
-     * Schuh et al.'s main experiments), the join result is not materialized.
-     * Rather, we locate and access the matches' payloads.
-     */
-    checksum += HTable[k];
-
-    #if !TEST_KEY_INPLACEOF_PAYLOAD
-      ++matches;
-    #else
-      if(HTable[k] == k) ++matches;
-    #endif
+  /* Probe HTable from S (own sub-relation, or claimed morsels). */
+  morsel_iter_t It = {0, 0};
+  relation_t *S;
+  uint32_t    from, to;
+
+  while(morsel_next(T, &It, &S, &from, &to)) {
+    for(uint32_t i = from; i < to; i++) {
+      tkey_t k = key_at(S, i);
+
+      /*
+       * Gather, NOPA-style Array-based.
+       * For comparability with previous work (e.g., Balkesen et al., Kim et
+       * al., Schuh et al.'s main experiments), the join result is not
+       * materialized. Rather, we locate and access the matches' payloads.
+       * A bucket holds its payload (or key) plus one, so that zero marks an
+       * empty bucket whatever the payloads; the largest payload is reserved.
+       */
+      checksum += HTable[k];
+
+      #if !KEY_INPLACEOF_PAYLOAD
+        matches += (HTable[k] != 0);
+      #else
+        if(HTable[k] == k + 1) ++matches;
+      #endif
+    }
   }
 
   // NOTE: global_timer_report() contains (a necessary) barrier().
@@ -90,11 +98,13 @@ void ColBP_I(thread_t* T) { assert(Radix.R == 0 && Radix.S == 0);
 
   /* Set thread-local matches and checksum. */
   T->matches  = matches;
-  T->checksum = checksum;
+  T->checksum = checksum - matches; // Matched buckets hold payload + 1.
 
   /* Cleanup. */
+  morsels_cleanup(T);
+
   if(tid == 0) {
-    free(Threads.HTables[0]);
+    HugeFree(Threads.HTables[0]);
     free(Threads.HTables);
   }
 
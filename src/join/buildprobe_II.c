@@ -10,6 +10,18 @@
 #include <string.h>
 #include "common.h"
 
+/* Global Variables. */
+static __thread arena_mark_t TablesMark; // Group leader's arena before tables.
+
+/* Function Declarations. */
+void ICP(thread_t*, relation_t*, uint32_t, block_meta_t*);
+bool ICP_deferred_S();
+uint32_t ColBP_II_table_size();
+bool ColBP_II_clear_tables();
+void ColBP_II_table_clear(bucket_t*, uint32_t, uint32_t);
+void ColBP_II_tables_prepare(thread_t*, uint32_t);
+void ColBP_II_tables_cleanup(thread_t*, uint32_t);
+
 
 void ColBP_II(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
   uint64_t matches = 0, checksum = 0;
@@ -21,45 +33,17 @@ void ColBP_II(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
   assert(tid % num_groups == group); // expected from prepare_threads_meta()
 
   /* Sub-Relations. */
-  tuple_t *R = T->SubR->tuples;
-  tuple_t *S = T->SubS->tuples;
+  relation_t *R = T->SubR;
+  relation_t *S = T->SubS;
 
-  /* ICP "Blocks" Data. */
+  /* ICP "Blocks" Data. [S's are set later if its ICP() is deferred.] */
   block_t **BlocksR      = T->BlocksR.Pos;
   block_t **BlocksS      = T->BlocksS.Pos;
   uint32_t  num_blocks_R = T->BlocksR.N;
   uint32_t  num_blocks_S = T->BlocksS.N;
 
-  /*
-   * Allocate and NUMA-distribute Hash Table(s).
-   * Given threads lie on x LLCs, allocate x hash tables.
-   */
-  uint32_t avg_partition = (Threads.RelR->size >> Radix.R) + 1;
-  uint32_t HTable_size   = 1 << lg_ceil(avg_partition);
-
-  // Thread zero allocates list of tables.
-  if(tid == 0) Threads.HTables = SafeMalloc(num_groups * sizeof(bucket_t*));
-
-  barrier(); // Wait for allocation.
-
-  // One thread from each group allocates one table.
-  if(tid == group) { // (relies on assertion `tid % num_groups == group`)
-    Threads.HTables[group] = SafeMalloc(HTable_size * sizeof(bucket_t));
-  }
-
-  barrier(); // Wait for allocation(s).
-
-  // NUMA-distribute each table.
-  for(uint32_t g = 0; g < num_groups; g++) {
-    uint32_t t      = num_groups * 2; // 2 threads per group (arbitrary).
-    bucket_t *Table = Threads.HTables[g];
-    uint32_t share  = HTable_size / t;
-    uint32_t offset = tid * share;
-
-    if(tid < t) memset(Table + offset, 0, share * sizeof(bucket_t));
-  }
-
-  barrier(); // Wait for NUMA distribution.
+  /* Allocate and NUMA-distribute Hash Table(s). */
+  ColBP_II_tables_prepare(T, 1);
 
 
   /*
@@ -93,15 +77,16 @@ void ColBP_II(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
         uint32_t radix = Radix.R;
         uint32_t mask  = MaskR;
 
-        for(; idx < end && p == HASH(R[idx].key, mask); idx++) {
-          tuple_t t = R[idx];
+        for(; idx < end && p == HASH(key_at(R, idx), mask); idx++) {
+          tuple_t t = tuple_at(R, idx);
           tkey_t  k = t.key;
 
           /* Scatter, CPRA-style Array-based. */
-          #if !TEST_KEY_INPLACEOF_PAYLOAD
-            HTable[k >> radix] = t.payload;
+          assert(k <= Threads.max_key); // Bounded by the table (see relfile.c).
+          #if !KEY_INPLACEOF_PAYLOAD
+            HTable[k >> radix] = t.payload + 1;
           #else
-            HTable[k >> radix] = k;
+            HTable[k >> radix] = k + 1;
           #endif
 
           checksum += k;
@@ -110,6 +95,13 @@ void ColBP_II(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
         BlocksR[b][h].start = idx; // Update index within sub-block.
       }
 
+      /* With --overlap, partition own S while other threads are building. */
+      if(i == 0 && g == num_groups - 1 && ICP_deferred_S()) {
+        ICP(T, T->SubS, Radix.S, &T->BlocksS);
+        BlocksS      = T->BlocksS.Pos;
+        num_blocks_S = T->BlocksS.N;
+      }
+
       sbarrier(tid); // Synchronize swapping hash tables across groups.
       // NOTE: This is not necessary for correctness, but may contribute
       // to performance. Essentially, it reduces cross-LLC false sharing.
@@ -134,9 +126,8 @@ void ColBP_II(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
         uint32_t shift = Radix.R;
         uint32_t mask  = MaskS;
 
-        for(; idx < end && p == HASH(S[idx].key, mask); idx++) {
-          tuple_t t = S[idx];
-          tkey_t  k = t.key;
+        for(; idx < end && p == HASH(key_at(S, idx), mask); idx++) {
+          tkey_t k = key_at(S, idx);
 
           /*
            * Gather, CPRA-style Array-based.
@@ -147,10 +138,10 @@ void ColBP_II(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
            */
           checksum += HTable[k >> shift];
 
-          #if !TEST_KEY_INPLACEOF_PAYLOAD
-            ++matches;
+          #if !KEY_INPLACEOF_PAYLOAD
+            matches += (HTable[k >> shift] != 0);
           #else
-            if(HTable[k >> shift] == k) ++matches;
+            if(HTable[k >> shift] == k + 1) ++matches;
           #endif
         }
 
@@ -160,12 +151,23 @@ void ColBP_II(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
 
 
     sbarrier(tid); // Avoid building for new partitions until probing is done.
+
+    /* If needed, the group's threads clear its table for the next round. */
+    if(ColBP_II_clear_tables() && i + 1 < iters) {
+      uint32_t members = (Threads.N - group + num_groups - 1) / num_groups;
+      ColBP_II_table_clear(Threads.HTables[group], tid / num_groups, members);
+
+      // Avoid building for new partitions until cleared. Only the group's
+      // threads build its table first (g = 0); the others reach it after
+      // the next sbarrier().
+      group_barrier(T);
+    }
   }
 
 
   /* Set thread-local matches and checksum. */
   T->matches  = matches;
-  T->checksum = checksum;
+  T->checksum = checksum - matches; // Matched buckets hold payload + 1.
 
   /*
    * Cleanup.
@@ -173,8 +175,107 @@ void ColBP_II(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
    * For Model II, there is a barrier after each probing iteration, so that
    * suffices.
    */
-  if(tid == group) free(Threads.HTables[group]);
-  if(tid == 0)     free(Threads.HTables);
+  ColBP_II_tables_cleanup(T, 1);
 
   return;
 }
+
+
+
+/*
+ * Returns the number of buckets of each Model II Hash Table.
+ */
+uint32_t ColBP_II_table_size() {
+  uint32_t avg_partition = (Threads.max_key >> Radix.R) + 1;
+  return 1 << lg_ceil(avg_partition);
+}
+
+
+/*
+ * Returns whether Model II Hash Tables must be cleared between rounds.
+ * A table is reused for one partition per round. If R's (unique) keys are
+ * dense, i.e., exactly [1, |R|], each round's build overwrites every bucket
+ * its probes access. Otherwise (e.g., sparse keys, or keys of S without a
+ * match), a probe could find an entry left by a previous round's partition.
+ */
+bool ColBP_II_clear_tables() {
+  return Threads.max_key != Threads.RelR->size;
+}
+
+
+/*
+ * Clears Model II Hash Table `Table`, shared among `members` threads, of
+ * which the caller is the `member`-th.
+ */
+void ColBP_II_table_clear(bucket_t *Table, uint32_t member, uint32_t members) {
+  uint32_t HTable_size = ColBP_II_table_size();
+  uint32_t share       = HTable_size / members;
+  uint32_t offset      = member * share;
+
+  if(member == members - 1) share = HTable_size - offset;
+  memset(Table + offset, 0, share * sizeof(bucket_t));
+}
+
+
+/*
+ * Allocates and NUMA-distributes the Model II Hash Table(s).
+ * Given threads lie on x LLCs, allocates x hash tables per buffer; table h of
+ * buffer b is Threads.HTables[b * x + h].
+ */
+void ColBP_II_tables_prepare(thread_t* T, uint32_t buffers) {
+  uint32_t tid        = T->tid;
+  uint32_t group      = T->group;
+  uint32_t num_groups = Threads.num_groups;
+  uint32_t num_tables = num_groups * buffers;
+
+  uint32_t HTable_size = ColBP_II_table_size();
+
+  // Thread zero allocates list of tables.
+  if(tid == 0) Threads.HTables = SafeMalloc(num_tables * sizeof(bucket_t*));
+
+  barrier(); // Wait for allocation.
+
+  // One thread from each group allocates its group's table(s), from its
+  // (NUMA-local) arena.
+  if(tid == group) { // (relies on assertion `tid % num_groups == group`)
+    TablesMark = arena_mark(T);
+
+    for(uint32_t b = 0; b < buffers; b++) {
+      Threads.HTables[b * num_groups + group] =
+        ArenaAlloc(T, HTable_size * sizeof(bucket_t));
+    }
+  }
+
+  barrier(); // Wait for allocation(s).
+
+  // NUMA-distribute (and clear) each table. The last share includes the
+  // remainder, as arena memory is not necessarily zeroed.
+  for(uint32_t g = 0; g < num_tables; g++) {
+    uint32_t t      = MIN(num_groups * 2, Threads.N); // 2 threads per group
+    bucket_t *Table = Threads.HTables[g];             // (arbitrary).
+    uint32_t share  = HTable_size / t;
+    uint32_t offset = tid * share;
+
+    if(tid == t - 1) share = HTable_size - offset;
+    if(tid < t) memset(Table + offset, 0, share * sizeof(bucket_t));
+  }
+
+  barrier(); // Wait for NUMA distribution.
+
+  return;
+}
+
+
+/*
+ * Frees the Model II Hash Table(s).
+ * This cleanup should not occur until all probing is complete.
+ */
+void ColBP_II_tables_cleanup(thread_t* T, uint32_t buffers) {
+  // Releases the table(s) [and anything allocated later, e.g., by a
+  // deferred ICP() of S, which is no longer needed either].
+  if(T->tid == T->group) arena_release(T, TablesMark);
+
+  barrier(); // Wait until all tables are freed, before freeing their list.
+
+  if(T->tid == 0)        free(Threads.HTables);
+}
@@ -24,9 +24,7 @@ void ColBP_III(thread_t* T) { assert(Radix.R > 0 && Radix.S == 0);
   assert(tid % num_groups == group); // expected from prepare_threads_meta()
 
   /* Sub-Relations and ICP "Blocks" Data (applicable only for R). */
-  tuple_t *R             = T->SubR->tuples;
-  tuple_t *S             = T->SubS->tuples;
-  uint32_t sizeS         = T->SubS->size;
+  relation_t *R          = T->SubR;
   block_t **BlocksR      = T->BlocksR.Pos;
   uint32_t  num_blocks_R = T->BlocksR.N;
 
@@ -35,15 +33,23 @@ void ColBP_III(thread_t* T) { assert(Radix.R > 0 && Radix.S == 0);
    * NUMA-distribution of regions in the aggregate hash table is achieved
    * naturally by how the build phase proceeds in Model III.
    */
-  uint32_t HTable_size   = Threads.RelR->size + 1;
+  uint32_t HTable_size   = Threads.max_key + 1;
   if(tid == 0) {
     Threads.HTables    = SafeMalloc(sizeof(bucket_t*));
-    Threads.HTables[0] = SafeMalloc(HTable_size * sizeof(bucket_t));
+    Threads.HTables[0] = HugeAlloc(HTable_size * sizeof(bucket_t), AllNodes);
   }
 
 
   barrier(); // Wait until allocation is done.
 
+  /* Zero the table in parallel (the last thread also zeroes the remainder). */
+  uint32_t share  = HTable_size / Threads.N;
+  uint32_t offset = tid * share;
+  if(tid == Threads.N - 1) share = HTable_size - offset;
+  memset(Threads.HTables[0] + offset, 0, share * sizeof(bucket_t));
+
+  barrier(); // Wait until the table is zeroed.
+
   /*
    * Cooperative Build Phase Iterations.
    * Model III requires all hash tables for all R-partitions to be constructed
@@ -72,15 +78,16 @@ void ColBP_III(thread_t* T) { assert(Radix.R > 0 && Radix.S == 0);
         uint32_t shift = ModelIII_shift;
         uint32_t mask  = MaskR;
 
-        for(; idx < end && p == HASHx(R[idx].key, mask, shift); idx++) {
-          tuple_t t = R[idx];
+        for(; idx < end && p == HASHx(key_at(R, idx), mask, shift); idx++) {
+          tuple_t t = tuple_at(R, idx);
           tkey_t  k = t.key;
 
           /* Scatter, NOPA/CPRA-style Array-based. */
-          #if !TEST_KEY_INPLACEOF_PAYLOAD
-            GlobalTable[k] = t.payload;
+          assert(k <= Threads.max_key); // Bounded by the table (see relfile.c).
+          #if !KEY_INPLACEOF_PAYLOAD
+            GlobalTable[k] = t.payload + 1;
           #else
-            GlobalTable[k] = k;
+            GlobalTable[k] = k + 1;
           #endif
 
           checksum += k;
@@ -94,27 +101,34 @@ void ColBP_III(thread_t* T) { assert(Radix.R > 0 && Radix.S == 0);
   }
 
 
-  barrier(); // Wait until all tables are constructed. [Actually, is redundant!]
+  morsels_prepare(T); // Published by the barrier below.
 
+  barrier(); // Wait until all tables are constructed. [Actually, is redundant!]
 
-  /* Cooperative Probe Phase. */
-  for(uint32_t i = 0; i < sizeS; i++) {
-    tuple_t t = S[i];
-    tkey_t  k = t.key;
 
-    /*
-     * Gather, NOPA/CPRA-style Array-based.
-     * For comparability with previous work (e.g., Balkesen et al., Kim et al.,
-     * Schuh et al.'s main experiments), the join result is not materialized.
-     * Rather, we locate and access the matches' payloads.
-     */
-    checksum += GlobalTable[k];
-
-    #if !TEST_KEY_INPLACEOF_PAYLOAD
-      ++matches;
-    #else
-      if(GlobalTable[k] == k) ++matches;
-    #endif
+  /* Cooperative Probe Phase (own sub-relation of S, or claimed morsels). */
+  morsel_iter_t It = {0, 0};
+  relation_t *S;
+  uint32_t    from, to;
+
+  while(morsel_next(T, &It, &S, &from, &to)) {
+    for(uint32_t i = from; i < to; i++) {
+      tkey_t k = key_at(S, i);
+
+      /*
+       * Gather, NOPA/CPRA-style Array-based.
+       * For comparability with previous work (e.g., Balkesen et al., Kim et
+       * al., Schuh et al.'s main experiments), the join result is not
+       * materialized. Rather, we locate and access the matches' payloads.
+       */
+      checksum += GlobalTable[k];
+
+      #if !KEY_INPLACEOF_PAYLOAD
+        matches += (GlobalTable[k] != 0);
+      #else
+        if(GlobalTable[k] == k + 1) ++matches;
+      #endif
+    }
   }
 
   barrier(); // Wait until all probing is done (before cleanup).
@@ -122,11 +136,13 @@ void ColBP_III(thread_t* T) { assert(Radix.R > 0 && Radix.S == 0);
 
   /* Set thread-local matches and checksum. */
   T->matches  = matches;
-  T->checksum = checksum;
+  T->checksum = checksum - matches; // Matched buckets hold payload + 1.
 
   /* Cleanup. */
+  morsels_cleanup(T);
+
   if(tid == 0) {
-    free(Threads.HTables[0]);
+    HugeFree(Threads.HTables[0]);
     free(Threads.HTables);
   }
 
@@ -0,0 +1,245 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Collaborative Building and Probing (ColBP) Procedures, Model II,
+ * with Dynamic (Work-stealing) Scheduling.
+ * (Refer to note in run.c w.r.t. ColBP models)
+ *
+ * Unlike ColBP_II(), groups do not advance in lockstep. Each hash table
+ * (one per group, as in ColBP_II) owns a queue of tasks for the partitions
+ * of its sub-block, processed round by round. A task covers `TaskBlocks`
+ * blocks of one thread's sub-relation, for the table's current partition.
+ *
+ * Each round of a table goes through two stages (three, if tables must be
+ * cleared between rounds; see ColBP_II_clear_tables()):
+ *   (a) Build: its build tasks are claimable; the last finished task opens (b).
+ *   (b) Probe: its probe tasks are claimable; the last finished task opens
+ *       (c), or else the build stage of the next round.
+ *   (c) Clear: its clear tasks, each zeroing one of `ClearTasks` chunks of
+ *       the table, are claimable; the last finished task opens the build
+ *       stage of the next round.
+ * Hence, a table is never cleared or rebuilt while any thread is still
+ * probing it.
+ *
+ * Threads prefer their own group's table and steal from other groups' tables
+ * whenever their own has no claimable task.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "common.h"
+
+/* Constants. */
+#define TaskBlocks 4 // # of (ICP) blocks per task.
+
+/* Function Declarations. */
+bool ColBP_II_clear_tables();
+void ColBP_II_table_clear(bucket_t*, uint32_t, uint32_t);
+void ColBP_II_tables_prepare(thread_t*, uint32_t);
+void ColBP_II_tables_cleanup(thread_t*, uint32_t);
+
+/* Task Queue of one Hash Table [one cache line, to avoid false sharing]. */
+typedef struct {
+  volatile uint64_t build_claim; // (round << 32) | next unclaimed build task.
+  volatile uint64_t probe_claim; // (round << 32) | next unclaimed probe task.
+  volatile uint64_t clear_claim; // (round << 32) | next unclaimed clear task.
+  volatile uint32_t build_left;  // # of unfinished build tasks in round.
+  volatile uint32_t probe_left;  // # of unfinished probe tasks in round.
+  volatile uint32_t clear_left;  // # of unfinished clear tasks in round.
+} __attribute__((aligned(64))) task_queue_t;
+
+/* Global Variables. */
+static task_queue_t     *Queues;
+static volatile uint32_t FinishedQueues;
+static uint32_t          BuildTasks, ProbeTasks, ClearTasks; // Per round.
+
+
+/*
+ * Claims the next task under `word` if any is left, setting round and task.
+ * Packing the round with the counter prevents claiming a task of a round
+ * that was concurrently completed.
+ */
+static bool claim(volatile uint64_t *word, uint32_t num_tasks,
+                  uint32_t *round, uint32_t *task)
+{
+  uint64_t old = *word;
+
+  while((uint32_t)old < num_tasks) {
+    uint64_t cur = __sync_val_compare_and_swap(word, old, old + 1);
+
+    if(cur == old) {
+      *round = old >> 32;
+      *task  = (uint32_t)old;
+      return true;
+    }
+
+    old = cur;
+  }
+
+  return false;
+}
+
+
+/*
+ * Scatters (build) or gathers (probe) the tuples of partition p found
+ * in sub-block h of the blocks of task `task`.
+ */
+static void run_task(bool build, uint32_t h, uint32_t p, uint32_t task,
+                     uint64_t *matches, uint64_t *checksum)
+{
+  thread_t     *A      = Threads.Args + (task % Threads.N);
+  relation_t   *Sub    = build ? A->SubR : A->SubS;
+  block_meta_t *Blocks = build ? &A->BlocksR : &A->BlocksS;
+  bucket_t     *HTable = Threads.HTables[h];
+
+  uint32_t from  = (task / Threads.N) * TaskBlocks;
+  uint32_t to    = MIN(from + TaskBlocks, Blocks->N);
+  uint32_t shift = Radix.R;
+  uint32_t mask  = MaskR;
+
+  for(uint32_t b = from; b < to; b++) {
+    uint32_t idx = Blocks->Pos[b][h].start;
+    uint32_t end = Blocks->Pos[b][h].end;
+
+    for(; idx < end && p == HASH(key_at(Sub, idx), mask); idx++) {
+      tkey_t k = key_at(Sub, idx); // (Payloads only gathered if building.)
+
+      if(build) {
+        /* Scatter, CPRA-style Array-based. */
+        assert(k <= Threads.max_key); // Bounded by the table (see relfile.c).
+        #if !KEY_INPLACEOF_PAYLOAD
+          HTable[k >> shift] = tuple_at(Sub, idx).payload + 1;
+        #else
+          HTable[k >> shift] = k + 1;
+        #endif
+
+        *checksum += k;
+      }
+      else {
+        /* Gather, CPRA-style Array-based (see note in ColBP_II). */
+        *checksum += HTable[k >> shift];
+
+        #if !KEY_INPLACEOF_PAYLOAD
+          *matches += (HTable[k >> shift] != 0);
+        #else
+          if(HTable[k >> shift] == k + 1) ++(*matches);
+        #endif
+      }
+    }
+
+    Blocks->Pos[b][h].start = idx; // Update index within sub-block.
+  }
+}
+
+
+void ColBP_II_dynamic(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
+  uint64_t matches = 0, checksum = 0;
+
+  /* Thread Data. */
+  uint32_t tid        = T->tid;
+  uint32_t group      = T->group;
+  uint32_t num_groups = Threads.num_groups;
+  uint32_t iters      = FanoutR / num_groups; // Rounds per table.
+  assert(FanoutR % num_groups == 0);
+
+  /* Thread zero prepares the queues; published by the barriers below. */
+  if(tid == 0) {
+    uint32_t max_blocks_R = 0, max_blocks_S = 0;
+
+    for(uint32_t t = 0; t < Threads.N; t++) {
+      max_blocks_R = MAX(max_blocks_R, Threads.Args[t].BlocksR.N);
+      max_blocks_S = MAX(max_blocks_S, Threads.Args[t].BlocksS.N);
+    }
+
+    BuildTasks = Threads.N * div_ceil(max_blocks_R, TaskBlocks);
+    ProbeTasks = Threads.N * div_ceil(max_blocks_S, TaskBlocks);
+    ClearTasks = Threads.N;
+
+    Queues = CacheLineAlignedAlloc(num_groups * sizeof(task_queue_t));
+    FinishedQueues = 0;
+
+    for(uint32_t h = 0; h < num_groups; h++) {
+      Queues[h].build_claim = 0;          // Round 0, build stage open.
+      Queues[h].probe_claim = ProbeTasks; // Round 0, probe stage closed.
+      Queues[h].clear_claim = ClearTasks; // Round 0, clear stage closed.
+      Queues[h].build_left  = BuildTasks;
+      Queues[h].probe_left  = ProbeTasks;
+      Queues[h].clear_left  = ClearTasks;
+    }
+  }
+
+  /* Allocate and NUMA-distribute Hash Table(s). */
+  ColBP_II_tables_prepare(T, 1);
+
+
+  /* Claim tasks until all tables have completed all their rounds. */
+  while(FinishedQueues < num_groups) {
+    bool worked = false;
+
+    for(uint32_t g = 0; g < num_groups && !worked; g++) {
+      uint32_t      h = (group + g) % num_groups; // Own table first.
+      task_queue_t *Q = Queues + h;
+      uint32_t round, task;
+
+      if(claim(&Q->probe_claim, ProbeTasks, &round, &task)) {
+        run_task(false, h, h * iters + round, task, &matches, &checksum);
+        worked = true;
+
+        // Last probe task of the round: open the round's clear stage, if
+        // needed (see ColBP_II_clear_tables()), or the next round's build.
+        if(__sync_sub_and_fetch(&Q->probe_left, 1) == 0) {
+          Q->probe_left = ProbeTasks;
+          __sync_synchronize();
+
+          if(round + 1 == iters) __sync_fetch_and_add(&FinishedQueues, 1);
+          else if(ColBP_II_clear_tables()) {
+            Q->clear_claim = (uint64_t)round << 32;
+          }
+          else Q->build_claim = (uint64_t)(round + 1) << 32;
+        }
+      }
+
+      else if(claim(&Q->clear_claim, ClearTasks, &round, &task)) {
+        ColBP_II_table_clear(Threads.HTables[h], task, ClearTasks);
+        worked = true;
+
+        // Last clear task of the round: open the next round's build stage.
+        if(__sync_sub_and_fetch(&Q->clear_left, 1) == 0) {
+          Q->clear_left = ClearTasks;
+          __sync_synchronize();
+
+          Q->build_claim = (uint64_t)(round + 1) << 32;
+        }
+      }
+
+      else if(claim(&Q->build_claim, BuildTasks, &round, &task)) {
+        run_task(true, h, h * iters + round, task, &matches, &checksum);
+        worked = true;
+
+        // Last build task of the round: open the round's probe stage.
+        if(__sync_sub_and_fetch(&Q->build_left, 1) == 0) {
+          Q->build_left = BuildTasks;
+          __sync_synchronize();
+
+          Q->probe_claim = (uint64_t)round << 32;
+        }
+      }
+    }
+
+    if(!worked) spin_relax();
+  }
+
+  barrier(); // Wait until no thread inspects the queues (before cleanup).
+
+
+  /* Set thread-local matches and checksum. */
+  T->matches  = matches;
+  T->checksum = checksum - matches; // Matched buckets hold payload + 1.
+
+  /* Cleanup. */
+  ColBP_II_tables_cleanup(T, 1);
+  if(tid == 0) free(Queues);
+
+  return;
+}
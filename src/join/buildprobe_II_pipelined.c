@@ -0,0 +1,238 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Collaborative Building and Probing (ColBP) Procedures, Model II,
+ * Pipelined with Double-buffered Hash Tables.
+ * (Refer to note in run.c w.r.t. ColBP models)
+ *
+ * Like ColBP_II(), but each group owns two hash tables (buffers), used by
+ * alternate rounds. Each thread builds round i+1 before probing round i:
+ *   build(0), build(1), probe(0), build(2), probe(1), ..., probe(iters-1).
+ * Hence, threads done building round i proceed to build round i+1 while
+ * slower threads are still building round i, instead of idling at barriers.
+ *
+ * Instead of sbarrier(), each (table, buffer) pair keeps counters of
+ * finished threads, which only ever grow:
+ *   (a) built:   before probing a table, wait until all threads built it.
+ *   (b) drained: before rebuilding a buffer (two rounds later), wait until
+ *                all threads probed its previous contents (counted by
+ *                `probed`), and it is cleared, if needed. Clearing is split
+ *                into N chunks, claimed (by `cleared`) by the last prober
+ *                and by threads waiting to rebuild the buffer, each chunk
+ *                adding one to `drained`.
+ * Every wait targets a step that precedes it in every thread's sequence
+ * above; hence, no wait cycle (deadlock) is possible.
+ *
+ * NOTE: Two tables per group halve the LLC capacity available to each;
+ *       hence, this variant may favor a larger fanout than ColBP_II().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "common.h"
+
+/* Constants. */
+#define Buffers 2
+
+/* Function Declarations. */
+void ICP(thread_t*, relation_t*, uint32_t, block_meta_t*);
+bool ICP_deferred_S();
+bool ColBP_II_clear_tables();
+void ColBP_II_table_clear(bucket_t*, uint32_t, uint32_t);
+void ColBP_II_tables_prepare(thread_t*, uint32_t);
+void ColBP_II_tables_cleanup(thread_t*, uint32_t);
+
+/* Flags of one (Table, Buffer) pair [one cache line, to avoid false sharing]. */
+typedef struct {
+  volatile uint32_t built;   // # of (thread, round) builds finished.
+  volatile uint32_t probed;  // # of (thread, round) probes finished.
+  volatile uint32_t cleared; // # of (chunk, round) clears claimed.
+  volatile uint32_t drained; // # of those whose table may be rebuilt.
+} __attribute__((aligned(64))) table_flags_t;
+
+/* Global Variables. */
+static table_flags_t *Flags;
+
+
+/*
+ * Waits until `*counter` reaches `target`.
+ */
+static inline void wait_for(volatile uint32_t *counter, uint32_t target) {
+  while(*counter < target) spin_relax();
+  __sync_synchronize(); // Order subsequent accesses after the observed count.
+}
+
+
+/*
+ * Claims and clears chunks of HTable (one of Threads.N per claim), counted
+ * by F's `cleared` and `drained`, until `target` chunks are claimed.
+ */
+static void clear_chunks(table_flags_t *F, bucket_t *HTable, uint32_t target) {
+  uint32_t chunk;
+
+  while((chunk = F->cleared) < target) {
+    if(!__sync_bool_compare_and_swap(&F->cleared, chunk, chunk + 1)) continue;
+
+    ColBP_II_table_clear(HTable, chunk % Threads.N, Threads.N);
+    __sync_fetch_and_add(&F->drained, 1); // (Full memory barrier.)
+  }
+}
+
+
+void ColBP_II_pipelined(thread_t* T) { assert(Radix.R == Radix.S && Radix.R > 0);
+  uint64_t matches = 0, checksum = 0;
+
+  /* Thread Data. */
+  uint32_t tid        = T->tid;
+  uint32_t group      = T->group;
+  uint32_t num_groups = Threads.num_groups;
+  uint32_t N          = Threads.N;
+  assert(tid % num_groups == group); // expected from prepare_threads_meta()
+
+  /* Sub-Relations. */
+  relation_t *R = T->SubR;
+  relation_t *S = T->SubS;
+
+  /* ICP "Blocks" Data. [S's are set later if its ICP() is deferred.] */
+  block_t **BlocksR      = T->BlocksR.Pos;
+  block_t **BlocksS      = T->BlocksS.Pos;
+  uint32_t  num_blocks_R = T->BlocksR.N;
+  uint32_t  num_blocks_S = T->BlocksS.N;
+
+  /* Thread zero prepares the flags; published by the barriers below. */
+  if(tid == 0) {
+    Flags = CacheLineAlignedAlloc(num_groups * Buffers * sizeof(table_flags_t));
+
+    for(uint32_t f = 0; f < num_groups * Buffers; f++) {
+      Flags[f].built = Flags[f].probed = Flags[f].cleared = 0;
+      Flags[f].drained = 0;
+    }
+  }
+
+  /* Allocate and NUMA-distribute Hash Table(s), two per group. */
+  ColBP_II_tables_prepare(T, Buffers);
+
+  /* TODO: Support FanoutR % num_groups != 0 (see buildprobe_II.c). */
+  uint32_t iters = FanoutR / num_groups;
+  assert(FanoutR % num_groups == 0);
+
+  for(uint32_t step = 0; step <= iters; step++) {
+    /*
+     * Build Phase of round `step`.
+     * Groups start at their own table and rotate, as in ColBP_II().
+     */
+    for(uint32_t g = 0; g < num_groups && step < iters; g++) {
+      uint32_t i        = step;
+      uint32_t h        = (g + group) % num_groups;       // Hash Table index.
+      uint32_t p        = h * iters + i;                  // Partition index.
+      uint32_t f        = (i % Buffers) * num_groups + h; // Table/Flags index.
+      bucket_t *HTable  = Threads.HTables[f];
+
+      // Wait until the buffer's previous round is probed by all threads,
+      // and help clearing it (if needed; see ColBP_II_clear_tables()).
+      if(ColBP_II_clear_tables()) {
+        wait_for(&Flags[f].probed, N * (i / Buffers));
+        clear_chunks(Flags + f, HTable, N * (i / Buffers));
+      }
+      wait_for(&Flags[f].drained, N * (i / Buffers));
+
+      /* Scan partitions (chunked across blocks) and Scatter. */
+      for(uint32_t b = 0; b < num_blocks_R; b++) {
+        uint32_t idx   = BlocksR[b][h].start;
+        uint32_t end   = BlocksR[b][h].end;
+        uint32_t radix = Radix.R;
+        uint32_t mask  = MaskR;
+
+        for(; idx < end && p == HASH(key_at(R, idx), mask); idx++) {
+          tuple_t t = tuple_at(R, idx);
+          tkey_t  k = t.key;
+
+          /* Scatter, CPRA-style Array-based. */
+          assert(k <= Threads.max_key); // Bounded by the table (see relfile.c).
+          #if !KEY_INPLACEOF_PAYLOAD
+            HTable[k >> radix] = t.payload + 1;
+          #else
+            HTable[k >> radix] = k + 1;
+          #endif
+
+          checksum += k;
+        }
+
+        BlocksR[b][h].start = idx; // Update index within sub-block.
+      }
+
+      __sync_fetch_and_add(&Flags[f].built, 1); // (Full memory barrier.)
+    }
+
+
+    /* With --overlap, partition own S before first probing it. */
+    if(step == 1 && ICP_deferred_S()) {
+      ICP(T, T->SubS, Radix.S, &T->BlocksS);
+      BlocksS      = T->BlocksS.Pos;
+      num_blocks_S = T->BlocksS.N;
+    }
+
+    /*
+     * Probe Phase of round `step - 1`.
+     * Tables built first (by all) are probed first; i.e., own table last.
+     */
+    for(int g = num_groups - 1; g >= 0 && step > 0; g--) {
+      uint32_t i        = step - 1;
+      uint32_t h        = (g + group) % num_groups;       // Hash Table index.
+      uint32_t p        = h * iters + i;                  // Partition index.
+      uint32_t f        = (i % Buffers) * num_groups + h; // Table/Flags index.
+      bucket_t *HTable  = Threads.HTables[f];
+
+      // Wait until the table is completely built by all threads.
+      wait_for(&Flags[f].built, N * (i / Buffers + 1));
+
+      /* Scan partitions (chunked across blocks) and Gather. */
+      for(uint32_t b = 0; b < num_blocks_S; b++) {
+        uint32_t idx   = BlocksS[b][h].start;
+        uint32_t end   = BlocksS[b][h].end;
+        uint32_t shift = Radix.R;
+        uint32_t mask  = MaskS;
+
+        for(; idx < end && p == HASH(key_at(S, idx), mask); idx++) {
+          tkey_t k = key_at(S, idx);
+
+          /* Gather, CPRA-style Array-based (see note in ColBP_II). */
+          checksum += HTable[k >> shift];
+
+          #if !KEY_INPLACEOF_PAYLOAD
+            matches += (HTable[k >> shift] != 0);
+          #else
+            if(HTable[k >> shift] == k + 1) ++matches;
+          #endif
+        }
+
+        BlocksS[b][h].start = idx; // Update index within sub-block.
+      }
+
+      // The round's last prober releases the table for rebuilding, or
+      // starts clearing it (if needed; see ColBP_II_clear_tables()).
+      uint32_t probed = __sync_add_and_fetch(&Flags[f].probed, 1);
+      if(probed % N == 0 && i + Buffers < iters) {
+        if(ColBP_II_clear_tables()) clear_chunks(Flags + f, HTable, probed);
+        else __sync_fetch_and_add(&Flags[f].drained, N); // (Full barrier.)
+      }
+    }
+  }
+
+
+  /* Set thread-local matches and checksum. */
+  T->matches  = matches;
+  T->checksum = checksum - matches; // Matched buckets hold payload + 1.
+
+  /*
+   * Cleanup.
+   * Unlike ColBP_II(), no barrier ends the last round; hence, wait here.
+   */
+  barrier(); // Wait until all probing is done (before cleanup).
+
+  ColBP_II_tables_cleanup(T, Buffers);
+  if(tid == 0) free(Flags);
+
+  return;
+}
@@ -0,0 +1,97 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Morsel-driven Probing of (unpartitioned) relation S, for Models I and III.
+ *
+ * Without morsels, each thread probes exactly its own sub-relation of S, so
+ * one slow thread delays the whole join. With morsels (--morsels), threads
+ * claim fixed-size ranges (morsels) of `MorselSize` tuples from per-thread
+ * atomic cursors: first from their own sub-relation, then from those of
+ * their own group's threads (sharing their LLC), then from those of other
+ * threads on their NUMA node (cpu_t.node, i.e., local data), and only then
+ * from remote nodes' threads. Hence, straggler time is bounded by about one
+ * morsel.
+ *
+ * Usage: morsels_prepare() by all threads, followed by a barrier; then
+ *        morsel_next() until it returns false; then, after another barrier,
+ *        morsels_cleanup() by all threads.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "common.h"
+
+/* Per-thread Cursor into its sub-relation of S [one per cache line]. */
+typedef struct {
+  volatile uint64_t next; // Offset of next unclaimed morsel.
+} __attribute__((aligned(64))) cursor_t;
+
+/* Global Variables. */
+static cursor_t *Cursors;
+
+
+/*
+ * Resets the cursors. Must be followed by a barrier before morsel_next().
+ */
+void morsels_prepare(thread_t *T) {
+  if(!Threads.morsel_probing || T->tid != 0) return;
+
+  Cursors = CacheLineAlignedAlloc(Threads.N * sizeof(cursor_t));
+  for(uint32_t t = 0; t < Threads.N; t++) Cursors[t].next = 0;
+}
+
+
+/*
+ * Sets [*from, *to) to the next range of *S, a sub-relation of S, for
+ * thread T to probe. Returns false once no range is left.
+ *
+ * Without morsels, the only range is the thread's own sub-relation.
+ * `It` must be zero-initialized before the first call.
+ */
+bool morsel_next(thread_t *T, morsel_iter_t *It, relation_t **S,
+                 uint32_t *from, uint32_t *to)
+{
+  if(!Threads.morsel_probing) {
+    if(It->pass++ > 0) return false;
+
+    *S    = T->SubS;
+    *from = 0;
+    *to   = T->SubS->size;
+    return true;
+  }
+
+  /*
+   * Pass 0 visits the threads of T's group, starting with T itself.
+   * Pass 1 visits the other threads of T's NUMA node.
+   * Pass 2 visits the threads of all other nodes.
+   */
+  for(; It->pass < 3; It->pass++, It->k = 0) {
+    for(; It->k < Threads.N; It->k++) {
+      uint32_t    v   = (T->tid + It->k) % Threads.N; // Victim.
+      relation_t *Sub = Threads.Args[v].SubS;
+
+      bool same_group = (Threads.Args[v].group == T->group);
+      bool same_node  = (Threads.Args[v].CPU->node == T->CPU->node);
+      uint32_t pass   = same_group ? 0 : (same_node ? 1 : 2);
+      if(pass != It->pass) continue;
+
+      uint64_t start = __sync_fetch_and_add(&Cursors[v].next, MorselSize);
+      if(start >= Sub->size) continue; // Exhausted; move on to next victim.
+
+      *S    = Sub;
+      *from = start;
+      *to   = MIN(start + MorselSize, Sub->size);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+/*
+ * Frees the cursors. Must be preceded by a barrier after all morsel_next().
+ */
+void morsels_cleanup(thread_t *T) {
+  if(Threads.morsel_probing && T->tid == 0) free(Cursors);
+}
@@ -7,9 +7,15 @@
  * tuples within small equal-sized blocks into their partitions.
  *
  * (b) Estimates skew at the granularity of a partition in S, skipping its
- * partitioning if high skew is observed (determined by arbitrary thresholds)
- * and |S| is significantly larger than |R|.
+ * partitioning if, given the largest partition observed, the cost model
+ * predicts Model III to be cheaper (see join/plan.c).
  *     [See more detailed note about skew estimation within ICP().]
+ *
+ * (c) Optionally estimates skew in S ahead of partitioning it, so that S's
+ * partitioning can be deferred until after R's (see --overlap in run.c).
+ *
+ * With --columnar, the histogram pass reads only the key column, and the
+ * scatter pass moves the key and payload columns side by side.
  */
 
 #include <stdlib.h>
@@ -20,9 +26,11 @@
 
 /* Function Declarations. */
 bool ICP_estimate_skew(uint32_t, counter_t*, uint32_t);
+void ICP_blocks_cleanup(thread_t*, block_meta_t*);
 
 /* Global Variables. */
-uint32_t HighSkewObserved = 0;
+uint32_t SkewMaxCount  = 0; // Sum of threads' largest partition counts,
+uint32_t SkewSampled   = 0; // of this many tuples of S.
 bool     ChangedRadixS    = false;
 uint8_t  ModelIII_shift;
 
@@ -37,14 +45,17 @@ void ICP(thread_t* Args, relation_t *Sub,
   uint32_t fanout = 1 << radix;
   uint32_t mask   = fanout - 1;
 
-  /* Under Model III, shift during hashing. */
+  /* Under Model III, shift during hashing (by at least zero bits). */
   if(Sub->id == 'R' && Radix.S == 0) {
-    shift = ModelIII_shift = lg_ceil(Threads.RelR->size) - Radix.R - 1;
+    uint32_t bits = lg_ceil(MAX(Threads.max_key, 1));
+    shift = ModelIII_shift = (bits > Radix.R + 1) ? bits - Radix.R - 1 : 0;
   }
 
-  /* Sub-Relation Info. */
-  tuple_t *T          = Sub->tuples;
-  uint32_t N          = Sub->size;
+  /* Sub-Relation Info. [Either T, or K and P (if columnar), are set.] */
+  tuple_t    *T       = Sub->tuples;
+  tkey_t     *K       = Sub->keys;
+  tpayload_t *P       = Sub->payloads;
+  uint32_t    N       = Sub->size;
 
   /*
    * Blocks-related Info.
@@ -75,25 +86,33 @@ void ICP(thread_t* Args, relation_t *Sub,
   /* Under Model IV, use one sub-block per block in partitioning relation S. */
   if(Sub->id == 'S' && Radix.R > Radix.S) num_sub_blocks = 1;
 
-  /* Allocate and prepare block-position structures. */
+  /* Allocate and prepare block-position structures (from thread's arena). */
   block_t **Pos;
-  Blocks->Pos = Pos = SafeMalloc(num_blocks * sizeof(block_t*));
-  block_t    *Array = SafeMalloc(num_sub_blocks * num_blocks * sizeof(block_t));
+  Blocks->mark = arena_mark(Args);
+  Blocks->Pos  = Pos = ArenaAlloc(Args, num_blocks * sizeof(block_t*));
+  block_t *Array = ArenaAlloc(Args, num_sub_blocks * num_blocks * sizeof(block_t));
 
   for(uint32_t i = 0; i < num_blocks; i++) {
     Pos[i] = Array + (i * num_sub_blocks);
   }
 
-  /* Allocate temporary ICP structures. */
-  counter_t *Histo     = SafeMalloc(fanout * sizeof(counter_t));
-  tuple_t   *TmpBlock = SafeMalloc(first_block_size * sizeof(tuple_t));
+  /* Allocate temporary ICP structures (released on return). */
+  arena_mark_t scratch  = arena_mark(Args);
+  counter_t   *Histo    = ArenaAlloc(Args, fanout * sizeof(counter_t));
+  size_t       tmp      = first_block_size; // (Rows, or columns.)
+  tuple_t     *TmpBlock = T ? ArenaAlloc(Args, tmp * sizeof(tuple_t)) : NULL;
+  tkey_t      *TmpKeys  = T ? NULL : ArenaAlloc(Args, tmp * sizeof(tkey_t));
+  tpayload_t  *TmpPays  = T ? NULL : ArenaAlloc(Args, tmp * sizeof(tpayload_t));
 
   /*
    * Directory to which current block's tuples are scattered.
    * Initially, this is set to a temporary buffer, TmpBlock.
    * Otherwise, it is set to the "previous" block.
+   * (Columns use DirKeys and DirPays likewise.)
    */
-  tuple_t *Directory = TmpBlock;
+  tuple_t    *Directory = TmpBlock;
+  tkey_t     *DirKeys   = TmpKeys;
+  tpayload_t *DirPays   = TmpPays;
 
 
   uint32_t block = 0;
@@ -108,15 +127,18 @@ void ICP(thread_t* Args, relation_t *Sub,
 
     /* Fill the histogram with frequency of each partition in block. */
     for(uint32_t j = 0; j < fanout; j++) Histo[j] = 0;
-    for(uint32_t j = from; j < to; j++) {
+    if(T) for(uint32_t j = from; j < to; j++) {
       ++Histo[ HASHx( T[j].key, mask, shift ) ];
     }
+    else  for(uint32_t j = from; j < to; j++) {
+      ++Histo[ HASHx( K[j], mask, shift ) ];
+    }
 
     /*
      * Skew Estimation.
      * When processing the first block in own sub-relation of S,
-     * skew is estimated. If high skew is observed in S (and other criteria
-     * are satisfied, e.g. |S| > a*|R|), the fanouts are changed and ICP
+     * skew is estimated. If, given the skew observed in S, Model III is
+     * predicted to be cheaper, the fanouts are changed and ICP
      * is restarted with the new fanout f_S (based on new Radix.S).
      * In terms of this code, Radix.S will be set to zero, thus stopping ICP.
      *
@@ -127,8 +149,7 @@ void ICP(thread_t* Args, relation_t *Sub,
          ICP_estimate_skew(Args->tid, Histo, first_block_size))
       {
         // Cleanup.
-        free(Pos);   free(Array);
-        free(Histo); free(TmpBlock);
+        arena_release(Args, Blocks->mark);
 
         // Restart ICP for relation S with new radix (if zero, ICP is stopped).
         ICP(Args, Sub, Radix.S, Blocks);
@@ -159,28 +180,42 @@ void ICP(thread_t* Args, relation_t *Sub,
 
 
     /* Scatter tuples to partitions, onto space in Directory. */
-    for(; i < to; i++) {
+    if(T) for(; i < to; i++) {
       tuple_t  t = T[i];
       uint32_t h = HASHx(t.key, mask, shift);
       Directory[ Histo[h]++ ] = t;
     }
+    else  for(; i < to; i++) {
+      tkey_t   k = K[i];
+      uint32_t h = HASHx(k, mask, shift);
+      DirKeys[ Histo[h] ]   = k;
+      DirPays[ Histo[h]++ ] = P[i];
+    }
 
     assert(Histo[fanout-1] == (to - from));
 
     /* Next Block, next Directory. */
-    if(Directory == TmpBlock) Directory = T;
-    else                       Directory += Histo[fanout-1];
+    if(block == 0) { Directory = T;  DirKeys = K;  DirPays = P; }
+    else if(T)       Directory += Histo[fanout-1];
+    else           { DirKeys   += Histo[fanout-1];
+                     DirPays   += Histo[fanout-1]; }
     block++;
   }
 
   /* Copy over the temporary buffer, TmpBlock, in place of last block. */
   assert(remainder == 0);
-  assert(( T + N - Directory ) == first_block_size);
-  memcpy(Directory, TmpBlock, first_block_size*sizeof(tuple_t));
+  if(T) {
+    assert(( T + N - Directory ) == first_block_size);
+    memcpy(Directory, TmpBlock, first_block_size*sizeof(tuple_t));
+  }
+  else {
+    assert(( K + N - DirKeys ) == first_block_size);
+    memcpy(DirKeys, TmpKeys, first_block_size*sizeof(tkey_t));
+    memcpy(DirPays, TmpPays, first_block_size*sizeof(tpayload_t));
+  }
 
   /* Cleanup. */
-  free(Histo);
-  free(TmpBlock);
+  arena_release(Args, scratch);
 
   return;
 }
@@ -188,51 +223,85 @@ void ICP(thread_t* Args, relation_t *Sub,
 
 
 /*
- * TODO: Describe Function.
- * Note arbitrary thresholds.
- * Note requires all threads to report high skew; somewhat conservative.
+ * Estimates skew in S from the partition histogram, Histo, of the first block
+ * (of block_size tuples) of each thread's sub-relation of S, as the mean of
+ * the threads' largest partition shares. Switches to Model III if the cost
+ * model predicts it to be cheaper given that skew (see join/plan.c).
+ * Either way, the model is then fixed (ChangedRadixS, set before the last
+ * barrier), so that no thread estimates skew again.
+ * Called by all threads; returns true iff switched.
  */
 bool ICP_estimate_skew(uint32_t tid, counter_t* Histo, uint32_t block_size) {
-  uint32_t maxA = 0, maxB = 0;
-
-  // Skip if |S| / |R| ratio is lower than threshold (3X).
-  if(Threads.RelS->size / Threads.RelR->size < 3) return false;
+  uint32_t max = 0;
 
-  /* Find frequencies of the two most common partitions. */
-  for(uint32_t j = 0; j < FanoutS; j++) {
-    if(Histo[j] > maxA) { maxB = maxA; maxA = Histo[j]; }
-    else if(Histo[j] > maxB) maxB = Histo[j];
-  }
+  /* Find the frequency of the most common partition. */
+  for(uint32_t j = 0; j < FanoutS; j++) max = MAX(max, Histo[j]);
 
-  uint32_t skew_threshold = block_size * 35 / 100; /* 35% in A,B of total. */
-
-  /* If skew exceeds threshold locally, increment global counter. */
-  if( (FanoutS >  4 && maxA+maxB > skew_threshold) ||
-      (FanoutS <= 4 && maxA > (block_size / 2) + 10) )
-  {
-    __sync_fetch_and_add(&HighSkewObserved, 1);
-  }
+  __sync_fetch_and_add(&SkewMaxCount, max);
+  __sync_fetch_and_add(&SkewSampled,  block_size);
 
   // Wait for all threads to report skew.
   sbarrier(tid);
 
-  /* Thread zero acts upon reported skew, if threads agreed upon high skew. */
-  if(tid == 0 && HighSkewObserved == Threads.N) {
+  /* Thread zero re-plans, given the reported skew. */
+  if(tid == 0) {
+    uint32_t radix = plan_model_III_radix((double)SkewMaxCount
+                                          / MAX(SkewSampled, 1));
     ChangedRadixS = true;
 
-    /* Print Message. */
-    printf("#>> High skew observed. Switching to Model III with "
-           "f_R = 2^(%d+1), f_S = 2^0.\n", Radix.R);
+    if(radix > 0) {
+      /* Print Message. */
+      printf("#>> High skew observed. Switching to Model III with "
+             "f_R = 2^%d, f_S = 2^0.\n", radix);
 
-    /* Set to Model III, with double fanout for relation R. */
-    Radix.S = 0;
-    Radix.R = Radix.R + 1;
+      /* Set to Model III. */
+      Radix.S = 0;
+      Radix.R = radix;
+    }
   }
 
   // Wait for new radix bits.
   sbarrier(tid);
 
-  return (HighSkewObserved == Threads.N);
+  return (Radix.S == 0);
+}
+
+
+
+/*
+ * Estimates skew from the first block of own sub-relation of S, as ICP()
+ * would, but without partitioning S. Afterwards, the model is fixed; hence,
+ * a later ICP() of S does not estimate skew again.
+ */
+void ICP_estimate_skew_early(thread_t* Args, relation_t *Sub) {
+  if(Radix.S == 0 || Radix.user_defined || ChangedRadixS) return;
+
+  /* First block of Sub, sized as in ICP(). */
+  uint32_t num_blocks       = MAX(div_ceil(Sub->size, ChunkSize), 1);
+  uint32_t first_block_size = Sub->size / num_blocks
+                              + (Sub->size % num_blocks > 0);
+
+  uint32_t   mask  = FanoutS - 1;
+  counter_t *Histo = SafeCalloc(FanoutS, sizeof(counter_t));
+
+  for(uint32_t j = 0; j < first_block_size; j++) {
+    ++Histo[ HASH(key_at(Sub, j), mask) ];
+  }
+
+  ICP_estimate_skew(Args->tid, Histo, first_block_size);
+  free(Histo);
+}
+
+
+
+/*
+ * Returns true iff ICP() of S is deferred to the build phase of the ColBP
+ * procedure (i.e., ColBP_II() or ColBP_II_pipelined(), where each thread
+ * probes only its own sub-relation of S). Valid once the model is fixed.
+ */
+bool ICP_deferred_S() {
+  return Threads.overlap_partitioning && !Threads.work_stealing &&
+         Radix.R == Radix.S && Radix.S > 0;
 }
 
 
@@ -241,13 +310,31 @@ bool ICP_estimate_skew(uint32_t tid, counter_t* Histo, uint32_t block_size) {
  * Thread-local ICP cleanup.
  */
 void ICP_cleanup(thread_t* Args) {
-  if(Radix.R > 0) {
-    free(*Args->BlocksR.Pos);
-    free(Args->BlocksR.Pos);
-  }
+  if(Radix.R > 0) ICP_blocks_cleanup(Args, &Args->BlocksR);
+  if(Radix.S > 0) ICP_blocks_cleanup(Args, &Args->BlocksS);
+}
 
-  if(Radix.S > 0) {
-    free(*Args->BlocksS.Pos);
-    free(Args->BlocksS.Pos);
-  }
+
+/*
+ * Releases the block-position structures of one partitioned sub-relation,
+ * along with anything allocated after them in the thread's arena.
+ */
+void ICP_blocks_cleanup(thread_t* Args, block_meta_t *Blocks) {
+  arena_release(Args, Blocks->mark);
+}
+
+
+/*
+ * Returns the bytes of arena ICP() uses to partition Sub with `radix`
+ * (a bound, for sizing arenas ahead of time).
+ */
+size_t ICP_arena_bytes(relation_t *Sub, uint32_t radix) {
+  if(radix == 0 || Sub->size == 0) return 0;
+
+  size_t num_blocks = div_ceil(Sub->size, ChunkSize);
+  size_t block_size = Sub->size / num_blocks + 1;
+
+  return num_blocks * (sizeof(block_t*) + Threads.num_groups * sizeof(block_t))
+         + (1 << radix) * sizeof(counter_t) + block_size * sizeof(tuple_t)
+         + 5 * 64; // (Alignment of up to five allocations.)
 }
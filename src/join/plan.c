@@ -0,0 +1,312 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Cost-based Planning.
+ *
+ * Predicts the run time of each join model, for each candidate fanout, from
+ * the machine's memory performance (SysInfo: bandwidths, latencies, LLC size,
+ * TLB reach and barrier cost) and from statistics sampled from the input, and
+ * selects the cheapest plan:
+ *
+ * (a) plan_join() samples keys of S, then sets Radix.R and Radix.S to the
+ *     cheapest of Model I, Model II with f_R = f_S = 2^r, and Model III with
+ *     f_R = 2^r (and f_S = 2^0), for 1 <= r <= MaxRadix.
+ * (b) plan_model_III_radix(share) re-evaluates the plan once ICP observes
+ *     the largest partition's share of S's first blocks (see partition.c),
+ *     returning Model III's radix if it is now predicted to be cheaper.
+ *
+ * Costs are in nanoseconds per thread, i.e., of the critical path, with:
+ *   > Streaming: bytes over the thread's share of its LLC's (or NUMA node's)
+ *     sequential bandwidth, or over a single thread's bandwidth, if less.
+ *   > Random table accesses: the LLC or memory latency, by the share of the
+ *     table (or of S's frequent keys) that fits in the LLC, plus page walks
+ *     beyond the TLB's reach, overlapped SysInfo.mem_parallelism at a time.
+ *   > ICP: as calibrated (SysInfo.scatter_ns, by one thread), but no less
+ *     than streaming its tuples thrice; or, otherwise, a histogram and a
+ *     scatter pass, the latter missing the L1 once the partitions' write
+ *     positions exceed `ScatterLines` cache lines.
+ *   > Model II: lockstep rounds wait for the largest partition among the
+ *     groups' (if the largest partition of S, as a share, times the number
+ *     of groups exceeds one).
+ *   > Models I and III: probes to keys that are frequent in S's sample hit
+ *     the LLC.
+ *
+ * NOTE: ICP partitions in a single pass, and Model IV (f_R > f_S > 2^0) is
+ *       not implemented (see run.c); neither is a candidate plan.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "common.h"
+
+/* Constants. */
+#define MaxRadix          14        // Largest candidate fanout, 2^14.
+#define PlanSample        (1 << 14) // Keys of S sampled.
+#define ScatterLines      512       // Write positions cached (L1) by ICP.
+
+/* Sampled Input Statistics. */
+typedef struct {
+  bool   ready;
+  double R, S;      // |R| and |S|.
+  double table;     // Bytes of a table spanning [0, max_key].
+  double hot_share; // Share of S's tuples whose keys are frequent (cached).
+  double max_share[MaxRadix + 1]; // Largest partition of S, per radix.
+} plan_stats_t;
+
+/* Global Variables. */
+static plan_stats_t Stats;
+
+/* Function Declarations. */
+static void   plan_sample();
+static double cost_model_I();
+static double cost_model_II(uint32_t);
+static double cost_model_III(uint32_t);
+static uint32_t max_radix_III();
+
+
+/*
+ * Returns the time, per thread, to stream the given bytes.
+ */
+static double stream_ns(double bytes) {
+  uint32_t threads_per_llc = div_ceil(Threads.N, Threads.utilized_llcs);
+  double   bandwidth = MIN(SysInfo.llc_bandwidth / threads_per_llc,
+                           SysInfo.node_bandwidth * SysInfo.num_nodes
+                           / Threads.N);
+  bandwidth = MIN(bandwidth, SysInfo.thread_bandwidth);
+
+  return bytes / bandwidth;
+}
+
+
+/*
+ * Returns the (overlapped) time of a random access to a table of the given
+ * bytes, of which at least share hit_floor of accesses hit the LLC.
+ */
+static double access_ns(double bytes, double hit_floor) {
+  double hit = MAX(MIN(1.0, SysInfo.llc_size / bytes), hit_floor);
+  double ns  = hit * SysInfo.llc_latency + (1 - hit) * SysInfo.mem_latency;
+
+  uint64_t page  = Threads.huge_pages ? SysInfo.page_size
+                                      : SysInfo.base_page_size;
+  double   reach = (double)SysInfo.tlb_entries * page;
+  if(bytes > reach) ns += (1 - hit) * (1 - reach / bytes)
+                          * SysInfo.tlb_miss_latency;
+
+  return ns / SysInfo.mem_parallelism;
+}
+
+
+/*
+ * Returns the time, per tuple, to partition by ICP with fanout 2^radix.
+ */
+static double scatter_ns(uint32_t radix) {
+  double ns = stream_ns(3.0 * sizeof(tuple_t)); // Histogram, scatter passes.
+
+  if(radix < CALIBRATED_RADICES && SysInfo.scatter_ns[radix] > 0) {
+    return MAX(SysInfo.scatter_ns[radix], ns);
+  }
+
+  uint32_t fanout = 1 << radix;
+  if(fanout > ScatterLines) {
+    ns += (1 - (double)ScatterLines / fanout) * SysInfo.llc_latency
+          / SysInfo.mem_parallelism;
+  }
+
+  return ns;
+}
+
+
+
+/*
+ * Model I: Build and probe one table, spanning all keys.
+ */
+static double cost_model_I() {
+  double n = Threads.N, w = sizeof(tuple_t);
+
+  return stream_ns(Stats.table / n)  // Zeroing the table.
+       + Stats.R / n * (stream_ns(w) + access_ns(Stats.table, 0))
+       + Stats.S / n * (stream_ns(w) + access_ns(Stats.table, Stats.hot_share))
+       + 2 * SysInfo.barrier_latency;
+}
+
+
+/*
+ * Model II: Partition R and S into 2^radix partitions, then build and probe
+ * one (LLC-resident) table per partition, in rounds of one per group.
+ */
+static double cost_model_II(uint32_t radix) {
+  double n = Threads.N, w = sizeof(tuple_t), fanout = 1 << radix;
+  double groups    = Threads.num_groups;
+  double partition = Stats.table / fanout;
+  double imbalance = MAX(1.0, Stats.max_share[radix] * groups);
+
+  return (Stats.R + Stats.S) / n * scatter_ns(radix)
+       + stream_ns(Stats.table / n)
+       + Stats.R / n * (stream_ns(w) + access_ns(partition, 0))
+       + Stats.S / n * (stream_ns(w) + access_ns(partition, 0)) * imbalance
+       + 3 * div_ceil(fanout, groups) * SysInfo.barrier_latency;
+}
+
+
+/*
+ * Model III: Partition R into 2^radix partitions, and build them in turn into
+ * one table, spanning all keys, which (unpartitioned) S then probes.
+ */
+static double cost_model_III(uint32_t radix) {
+  double n = Threads.N, w = sizeof(tuple_t), fanout = 1 << radix;
+
+  return Stats.R / n * scatter_ns(radix)
+       + stream_ns(Stats.table / n)
+       + Stats.R / n * (stream_ns(w) + access_ns(Stats.table / fanout, 0))
+       + Stats.S / n * (stream_ns(w) + access_ns(Stats.table, Stats.hot_share))
+       + div_ceil(fanout, Threads.num_groups) * SysInfo.barrier_latency;
+}
+
+
+
+/*
+ * Sets Radix.R and Radix.S to the plan of least predicted cost, and reports
+ * it. Requires R and S (and Threads.max_key) to be ready.
+ */
+void plan_join() {
+  plan_sample();
+
+  /* Model I. */
+  double best = cost_model_I(), best_II = INFINITY, best_III = INFINITY;
+  double cost_I = best;
+  Radix.R = Radix.S = 0;
+
+  /* Models II and III, for each fanout with non-empty partitions. */
+  uint32_t max_radix = MIN(MaxRadix, lg_floor(Threads.max_key + 1));
+  for(uint32_t r = 1; r <= max_radix; r++) {
+    double cost_II  = cost_model_II(r);
+    double cost_III = (r <= max_radix_III()) ? cost_model_III(r) : INFINITY;
+    best_II  = MIN(best_II,  cost_II);
+    best_III = MIN(best_III, cost_III);
+
+    if(cost_II  < best) { best = cost_II;  Radix.R = Radix.S = r; }
+    if(cost_III < best) { best = cost_III; Radix.R = r; Radix.S = 0; }
+  }
+
+  printf("Plan: Model %s [predicted %.2f ms; best of I: %.2f, II: %.2f, "
+         "III: %.2f ms].\n",
+         Radix.R == 0 ? "I" : (Radix.S == 0 ? "III" : "II"), best / 1e6,
+         cost_I / 1e6, best_II / 1e6, best_III / 1e6);
+}
+
+
+/*
+ * Given the observed share of S's largest partition (under the running plan,
+ * Model II with radix Radix.S), returns the radix (at least Radix.R) of the
+ * cheapest Model III, if it is predicted to be cheaper, or zero otherwise.
+ */
+uint32_t plan_model_III_radix(double max_share) {
+  if(!Stats.ready || Radix.S == 0) return 0;
+
+  Stats.max_share[Radix.S] = max_share;
+
+  double   best  = cost_model_II(Radix.S);
+  uint32_t radix = 0;
+
+  for(uint32_t r = Radix.R; r <= max_radix_III(); r++) {
+    double cost = cost_model_III(r);
+    if(cost < best) { best = cost; radix = r; }
+  }
+
+  return radix;
+}
+
+
+
+/*
+ * Returns Model III's largest radix, whose partitions (by the keys' high
+ * bits; see ICP()) are all non-empty: R + 1 <= lg_ceil(max_key).
+ */
+static uint32_t max_radix_III() {
+  uint32_t bits = lg_ceil(MAX(Threads.max_key, 1));
+  return MIN(MaxRadix, bits > 0 ? bits - 1 : 0);
+}
+
+
+
+static int compare_keys(const void *a, const void *b) {
+  tkey_t x = *(const tkey_t*)a, y = *(const tkey_t*)b;
+  return (x > y) - (x < y);
+}
+
+
+/*
+ * Sets Stats from sizes, and from keys sampled evenly across S's
+ * sub-relations:
+ *  > hot_share: share of sampled keys that occur more than once in the
+ *    sample (i.e., keys frequent enough to stay cached);
+ *  > max_share[r]: share of the largest of 2^r partitions of the sample, or
+ *    (exactly) of S, for r up to the bits of S's file histogram, if any.
+ */
+static void plan_sample() {
+  relation_t *RelS = Threads.RelS;
+
+  Stats.R     = Threads.RelR->size;
+  Stats.S     = RelS->size;
+  Stats.table = sizeof(bucket_t) * ((double)Threads.max_key + 1);
+
+  /* Sample keys of S. */
+  tkey_t  *Keys  = SafeMalloc(PlanSample * sizeof(tkey_t));
+  uint32_t count = 0;
+
+  for(uint32_t t = 0; t < Threads.N && RelS->size > 0; t++) {
+    relation_t *Sub  = Threads.Args[t].SubS;
+    uint32_t    take = (uint64_t)PlanSample * Sub->size / RelS->size;
+
+    for(uint32_t j = 0; j < take && count < PlanSample; j++) {
+      Keys[count++] = key_at(Sub, (uint64_t)j * Sub->size / take);
+    }
+  }
+
+  /* Largest partition, per radix. */
+  uint32_t *Histo = SafeCalloc(1 << MaxRadix, sizeof(uint32_t));
+  for(uint32_t r = 1; r <= MaxRadix; r++) {
+    uint32_t mask = (1 << r) - 1, max = 0;
+
+    memset(Histo, 0, (1 << r) * sizeof(uint32_t));
+    for(uint32_t j = 0; j < count; j++) {
+      uint32_t c = ++Histo[ HASH(Keys[j], mask) ];
+      max = MAX(max, c); // (MAX() evaluates its arguments twice.)
+    }
+
+    Stats.max_share[r] = count ? (double)max / count : 0;
+  }
+
+  /* Largest partition, per radix, from S's histogram (see relfile.c). */
+  for(uint32_t r = 1; r <= MIN(RelS->histo_bits, MaxRadix); r++) {
+    uint32_t mask = (1 << r) - 1;
+    uint64_t max  = 0, *Sums = SafeCalloc(1 << r, sizeof(uint64_t));
+
+    for(uint32_t j = 0; j < (1U << RelS->histo_bits); j++) {
+      uint64_t sum = (Sums[ HASH(j, mask) ] += RelS->histo[j]);
+      max = MAX(max, sum);
+    }
+
+    Stats.max_share[r] = RelS->size ? (double)max / RelS->size : 0;
+    free(Sums);
+  }
+
+  /* Frequent keys. */
+  qsort(Keys, count, sizeof(tkey_t), compare_keys);
+
+  uint32_t repeated = 0;
+  for(uint32_t j = 0; j < count; ) {
+    uint32_t k = j + 1;
+    while(k < count && Keys[k] == Keys[j]) k++;
+    if(k - j > 1) repeated += k - j;
+    j = k;
+  }
+
+  Stats.hot_share = count ? (double)repeated / count : 0;
+  Stats.ready     = true;
+
+  free(Histo);
+  free(Keys);
+}
@@ -0,0 +1,350 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Prepared Join (Build-once, Probe-many).
+ *
+ * (a) prepare_join() partitions R with ICP and builds the hash table(s) of
+ * the selected model once. The partitioned R, its block meta-data and the
+ * built table(s) stay resident until prepared_join_cleanup().
+ *
+ * (b) probe_prepared_join() partitions only the current S (if the model
+ * dictates so) and probes it against the resident table(s).
+ *
+ * (c) execute_prepared_join() drives (a) and (b) over many S batches.
+ *
+ * NOTE: Since R is built before any S is observed, the model is fixed by the
+ * radices at preparation time; skew estimation on S is disabled afterwards.
+ *
+ * Unlike ColBP_II(), which rebuilds Threads.num_groups tables in rounds,
+ * the prepared Model II keeps one CPRA-style table per R-partition resident.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "common.h"
+
+/* Function Declarations. */
+void  ICP(thread_t*, relation_t*, uint32_t, block_meta_t*);
+void  ICP_blocks_cleanup(thread_t*, block_meta_t*);
+void *recreate_S(void*);
+void  prepare_join();
+void  probe_prepared_join();
+void  prepared_join_cleanup();
+
+/* Global Variables. */
+extern bool    ChangedRadixS;
+static prepared_join_t Prepared;
+
+
+/*
+ * Runs prepare_join(), then probes `num_batches` batches of S against the
+ * prepared R. Batch zero is the already-generated S; each later batch is
+ * regenerated from a new seed.
+ */
+void execute_prepared_join(uint32_t num_batches) {
+  prepare_join();
+
+  for(uint32_t b = 0; b < num_batches; b++) {
+    if(b > 0) {
+      Threads.RelS->seed++;
+      relcache_prepare(Threads.RelS);
+      run_threads(recreate_S);
+      relcache_store(Threads.RelS);
+    }
+
+    printf("Probe Batch #%u:\n", b);
+    probe_prepared_join();
+  }
+
+  prepared_join_cleanup();
+
+  return;
+}
+
+
+
+/*
+ * Thread function: partitions own sub-relation of R and builds its tuples
+ * into the resident table(s).
+ */
+static void *prepare_thread(void* params) {
+  ttimer_t phase_timer;
+  thread_t *T          = (thread_t*)params;
+  uint32_t  tid        = T->tid;
+  uint32_t  group      = T->group;
+  uint32_t  num_groups = Threads.num_groups;
+  uint64_t  checksum   = 0;
+
+  global_timer_start(&phase_timer, tid);
+
+  /* Partition relation R. */
+  ICP(T, T->SubR, Radix.R, &T->BlocksR);
+
+  /* Allocate and NUMA-distribute the table(s). */
+  if(tid == 0) {
+    bool model_II      = (Radix.R == Radix.S && Radix.R > 0);
+    uint32_t partition = (Threads.max_key >> Radix.R) + 1;
+
+    Prepared.num_tables = model_II ? FanoutR : 1;
+    Prepared.table_size = model_II ? 1 << lg_ceil(partition)
+                                   : Threads.max_key + 1;
+    Prepared.HTables    = SafeMalloc(Prepared.num_tables * sizeof(bucket_t*));
+
+    if(!model_II) {
+      Prepared.HTables[0] =
+        HugeAlloc(Prepared.table_size * sizeof(bucket_t), AllNodes);
+    }
+  }
+
+  barrier(); // Wait for allocation.
+
+  if(Prepared.num_tables == 1) {
+    uint32_t share  = Prepared.table_size / Threads.N;
+    uint32_t offset = tid * share;
+    if(tid == Threads.N - 1) share = Prepared.table_size - offset;
+    memset(Prepared.HTables[0] + offset, 0, share * sizeof(bucket_t));
+  }
+  else {
+    // Tables of sub-block `group` are placed by that group's threads.
+    uint32_t members   = (Threads.N - group + num_groups - 1) / num_groups;
+    uint32_t per_group = Prepared.num_tables / num_groups;
+
+    for(uint32_t p = group * per_group; p < (group + 1) * per_group; p++) {
+      if(p % members != tid / num_groups) continue;
+
+      Prepared.HTables[p] =
+        HugeAlloc(Prepared.table_size * sizeof(bucket_t), T->CPU->node);
+      memset(Prepared.HTables[p], 0, Prepared.table_size * sizeof(bucket_t));
+    }
+  }
+
+  barrier(); // Wait for NUMA distribution.
+
+  /* Build from R. */
+  relation_t *R = T->SubR;
+
+  if(Radix.R == 0) {
+    bucket_t *HTable = Prepared.HTables[0];
+
+    for(uint32_t i = 0; i < T->SubR->size; i++) {
+      tuple_t t = tuple_at(R, i);
+      tkey_t  k = t.key;
+
+      /* Scatter, NOPA-style Array-based. */
+      assert(k <= Threads.max_key); // Bounded by the table (see relfile.c).
+      #if !KEY_INPLACEOF_PAYLOAD
+        HTable[k] = t.payload + 1;
+      #else
+        HTable[k] = k + 1;
+      #endif
+
+      checksum += k;
+    }
+  }
+  else {
+    /*
+     * Each group scans a distinct sub-block index of all blocks at a time.
+     * The block meta-data is only read, so it remains usable afterwards.
+     */
+    uint32_t radix = Radix.R;
+    uint32_t mask  = MaskR;
+
+    for(uint32_t g = 0; g < num_groups; g++) {
+      uint32_t h = (g + group) % num_groups;
+
+      for(uint32_t b = 0; b < T->BlocksR.N; b++) {
+        block_t block = T->BlocksR.Pos[b][h];
+
+        for(uint32_t idx = block.start; idx < block.end; idx++) {
+          tuple_t t = tuple_at(R, idx);
+          tkey_t  k = t.key;
+
+          /* Scatter, CPRA-style (Model II) or NOPA-style (Model III). */
+          bucket_t *B = (Prepared.num_tables == 1)
+                        ? Prepared.HTables[0] + k
+                        : Prepared.HTables[HASH(k, mask)] + (k >> radix);
+
+          assert(k <= Threads.max_key); // Bounded by the table (see relfile.c).
+          #if !KEY_INPLACEOF_PAYLOAD
+            *B = t.payload + 1;
+          #else
+            *B = k + 1;
+          #endif
+
+          checksum += k;
+        }
+      }
+    }
+  }
+
+  T->checksum = checksum;
+
+  global_timer_report(&phase_timer, tid, "#>> Total Preparation");
+
+  return NULL;
+}
+
+
+/*
+ * Partitions R and builds the resident table(s), once.
+ */
+void prepare_join() {
+  assert(!Prepared.ready);
+  assert(Radix.R == Radix.S || Radix.S == 0); // Model IV is unsupported.
+
+  run_threads(prepare_thread);
+
+  Prepared.radixR = Radix.R;
+  Prepared.radixS = Radix.S;
+  Prepared.ready  = true;
+
+  // The model is now fixed; disallow switching it on skew in S.
+  ChangedRadixS = true;
+
+  /* Print the build checksum; each probe reports its own below. */
+  uint64_t build_checksum = 0;
+  for(uint32_t t = 0; t < Threads.N; t++) {
+    build_checksum += Threads.Args[t].checksum;
+  }
+
+  build_checksum += Threads.min_key * Threads.RelR->size; // (See main.c.)
+  printf("Build Checksum: %lu.\n", build_checksum);
+
+  return;
+}
+
+
+
+/*
+ * Thread function: partitions own sub-relation of S and probes it.
+ */
+static void *probe_thread(void* params) {
+  ttimer_t phase_timer;
+  thread_t *T          = (thread_t*)params;
+  uint32_t  tid        = T->tid;
+  uint32_t  group      = T->group;
+  uint32_t  num_groups = Threads.num_groups;
+  uint64_t  matches = 0, checksum = 0;
+
+  global_timer_start(&phase_timer, tid);
+
+  /* Partition relation S (a no-op under Models I and III). */
+  ICP(T, T->SubS, Radix.S, &T->BlocksS);
+
+  relation_t *S = T->SubS;
+
+  if(Radix.S == 0) {
+    /* Models I and III: probe unpartitioned S against the global table. */
+    bucket_t *HTable = Prepared.HTables[0];
+
+    for(uint32_t i = 0; i < T->SubS->size; i++) {
+      tkey_t k = key_at(S, i);
+
+      /* Gather, NOPA-style Array-based. */
+      checksum += HTable[k];
+
+      #if !KEY_INPLACEOF_PAYLOAD
+        matches += (HTable[k] != 0);
+      #else
+        if(HTable[k] == k + 1) ++matches;
+      #endif
+    }
+  }
+  else {
+    /*
+     * Model II: probe partition-by-partition, in the same order as
+     * ColBP_II(), but with no barriers since no table is ever rebuilt.
+     */
+    block_t **BlocksS = T->BlocksS.Pos;
+    uint32_t  iters   = FanoutR / num_groups;
+    uint32_t  shift   = Radix.R;
+    uint32_t  mask    = MaskS;
+
+    for(uint32_t i = 0; i < iters; i++) {
+      for(int g = num_groups - 1; g >= 0; g--) {
+        uint32_t h       = (g + group) % num_groups; // Sub-block index.
+        uint32_t p       = h * iters + i;            // Partition index.
+        bucket_t *HTable = Prepared.HTables[p];      // Hash Table.
+
+        for(uint32_t b = 0; b < T->BlocksS.N; b++) {
+          uint32_t idx = BlocksS[b][h].start;
+          uint32_t end = BlocksS[b][h].end;
+
+          for(; idx < end && p == HASH(key_at(S, idx), mask); idx++) {
+            tkey_t k = key_at(S, idx);
+
+            /* Gather, CPRA-style Array-based. */
+            checksum += HTable[k >> shift];
+
+            #if !KEY_INPLACEOF_PAYLOAD
+              matches += (HTable[k >> shift] != 0);
+            #else
+              if(HTable[k >> shift] == k + 1) ++matches;
+            #endif
+          }
+
+          BlocksS[b][h].start = idx; // Update index within sub-block.
+        }
+      }
+    }
+
+    ICP_blocks_cleanup(T, &T->BlocksS);
+  }
+
+  T->matches  = matches;
+  T->checksum = checksum - matches; // Matched buckets hold payload + 1.
+
+  global_timer_report(&phase_timer, tid, "#>> Total Probe Batch");
+
+  return NULL;
+}
+
+
+/*
+ * Probes the current relation S against the prepared R.
+ */
+void probe_prepared_join() {
+  uint64_t total_matches   = 0;
+  uint64_t global_checksum = 0;
+
+  assert(Prepared.ready);
+  assert(Radix.R == Prepared.radixR && Radix.S == Prepared.radixS);
+
+  run_threads(probe_thread);
+
+  for(uint32_t t = 0; t < Threads.N; t++) {
+    total_matches   += Threads.Args[t].matches;
+    global_checksum += Threads.Args[t].checksum;
+  }
+
+  // Matched keys, if added up, were rebased (see main.c).
+  if(KEY_INPLACEOF_PAYLOAD) global_checksum += Threads.min_key * total_matches;
+  printf("Checksum: %lu.\n",      global_checksum);
+  printf("Total Matches: %lu.\n", total_matches);
+
+  return;
+}
+
+
+/*
+ * Frees the resident table(s) and R's block meta-data.
+ */
+void prepared_join_cleanup() {
+  if(!Prepared.ready) return;
+
+  for(uint32_t i = 0; i < Prepared.num_tables; i++) {
+    HugeFree(Prepared.HTables[i]);
+  }
+  free(Prepared.HTables);
+
+  if(Prepared.radixR > 0) {
+    for(uint32_t t = 0; t < Threads.N; t++) {
+      ICP_blocks_cleanup(Threads.Args + t, &Threads.Args[t].BlocksR);
+    }
+  }
+
+  Prepared.ready = false;
+
+  return;
+}
@@ -13,10 +13,17 @@
 void *join_thread(void*);
 void  ICP(thread_t*, relation_t*, uint32_t, block_meta_t*);
 void  ICP_cleanup(thread_t*);
+void  ICP_estimate_skew_early(thread_t*, relation_t*);
+bool  ICP_deferred_S();
 void  ColBP_I  (thread_t*);
 void  ColBP_II (thread_t*);
+void  ColBP_II_dynamic(thread_t*);
+void  ColBP_II_pipelined(thread_t*);
 void  ColBP_III(thread_t*);
 void  ColBP_IV (thread_t*);
+uint32_t ColBP_II_table_size();
+size_t   ICP_arena_bytes(relation_t*, uint32_t);
+static void tables_reserve();
 
 
 /*
@@ -26,6 +33,9 @@ void execute_join() {
   uint64_t total_matches   = 0;
   uint64_t global_checksum = 0;
 
+  /* Pre-fault the hash table(s), before the clock starts. */
+  if(Threads.prefault) tables_reserve();
+
   /* Execute the join by Threads.N threads in parallel. */
   run_threads(join_thread);
 
@@ -35,7 +45,10 @@ void execute_join() {
   }
 
   // NOTE: The value of checksum depends on whether we add up the payloads
-  // or the keys of matches. Refer to value of `TEST_KEY_INPLACEOF_PAYLOAD`.
+  // or the keys of matches. Refer to value of `KEY_INPLACEOF_PAYLOAD`.
+  // Either way, it adds up the (rebased; see main.c) keys of R.
+  global_checksum += Threads.min_key * (Threads.RelR->size +
+                     (KEY_INPLACEOF_PAYLOAD ? total_matches : 0));
   printf("Checksum: %lu.\n",      global_checksum);
   printf("Total Matches: %lu.\n", total_matches);
 
@@ -59,8 +72,14 @@ void *join_thread(void* params) {
   if(Radix.R > 0) {
     global_timer_start(&phase_timer, tid);
 
-    /* Partition relation S. */
-    ICP(T, T->SubS, Radix.S, &T->BlocksS);
+    /*
+     * Partition relation S.
+     * With --overlap, only skew is estimated here; under (lockstep or
+     * pipelined) Model II, each thread then partitions its own sub-relation
+     * of S during the build phase, right before it first probes it.
+     */
+    if(Threads.overlap_partitioning) ICP_estimate_skew_early(T, T->SubS);
+    if(!ICP_deferred_S())            ICP(T, T->SubS, Radix.S, &T->BlocksS);
 
     /* Partition relation R. */
     ICP(T, T->SubR, Radix.R, &T->BlocksR);
@@ -74,8 +93,10 @@ void *join_thread(void* params) {
    * Apply the appropriate CBP Join Model among I, II, III, IV.
    */
   if(Radix.R == Radix.S) {
-    if(Radix.R == 0) ColBP_I(T);
-    else             ColBP_II(T);
+    if(Radix.R == 0)                ColBP_I(T);
+    else if(Threads.work_stealing)  ColBP_II_dynamic(T);
+    else if(Threads.pipelined)      ColBP_II_pipelined(T);
+    else                            ColBP_II(T);
   }
   else {
     if(Radix.S == 0) ColBP_III(T);
@@ -83,7 +104,7 @@ void *join_thread(void* params) {
   }
 
 
-  /* Report Run Time. */
+  /* Report Run Time. [With --overlap, Build/Probe includes partitioning S.] */
   if(Radix.R > 0) {
     global_timer_report(&phase_timer, tid, "#>> Total Build/Probe");
   }
@@ -95,3 +116,34 @@ void *join_thread(void* params) {
 
   return NULL;
 }
+
+
+
+/*
+ * Reserves pre-faulted memory (see util/hugepage.c) for the planned model:
+ * each thread's arena is sized for its ICP data (plus, for group leaders,
+ * the group's Model II table(s)); Models I and III get their global table.
+ * If the model changes at run time (e.g., on skew), the global table's
+ * reservation is left unused, and freed by huge_pages_cleanup().
+ */
+static void tables_reserve() {
+  bool     model_II = (Radix.R == Radix.S && Radix.R > 0);
+  size_t   table    = model_II ? ColBP_II_table_size() * sizeof(bucket_t) : 0;
+  uint32_t buffers  = Threads.pipelined ? 2 : 1;
+
+  for(uint32_t t = 0; t < Threads.N; t++) {
+    thread_t *T    = Threads.Args + t;
+    size_t   bytes = ICP_arena_bytes(T->SubR, Radix.R)
+                   + ICP_arena_bytes(T->SubS, Radix.S);
+
+    if(t == T->group) bytes += buffers * (table + 64); // Group leader.
+
+    arena_reserve(T, bytes);
+  }
+
+  if(!model_II) {
+    huge_reserve((Threads.max_key + 1) * (size_t)sizeof(bucket_t), AllNodes);
+  }
+
+  return;
+}
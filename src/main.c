@@ -4,8 +4,10 @@
  * > Initializes default join parameters.
  * > Parses input arguments (via command line) to overwrite default parameters.
  *    # For more information about the arguments, refer to `util/cmd_args.c`.
- * > Generates the (random) input relations R and S.
+ * > Generates the (random) input relations R and S, or loads them from files.
  * > Runs PolyHJ, with automatic parameter selection (unless provided radices).
+ *    # Selection is cost-based; --calibrate measures the machine for it.
+ *    # With --probes=n, R is built once and probed by n batches of S.
  */
 
 #include <stdlib.h>
@@ -16,6 +18,15 @@
 #include "util/sys_info.h"
 #include "types.h"
 
+/* Default Machine Profile, per tuple width (named as the build; see Makefile). */
+#define Stringify(x)  #x
+#define ProfileOf(w)  "polyHJ-" Stringify(w) ".profile"
+#if TUPLE_WIDTH == 8
+  #define ProfilePath "polyHJ.profile"
+#else
+  #define ProfilePath ProfileOf(TUPLE_WIDTH)
+#endif
+
 /* Global Variables. */
 params_t          Threads;
 radix_info_t      Radix;
@@ -24,14 +35,16 @@ radix_info_t      Radix;
 void  extract_cmd_args(int, char **);
 void  prepare_threads_meta();
 void  prepare_threads_meta_cleanup();
+void  threads_regroup(uint32_t);
 void *create_R(void*);
 void *create_S(void*);
 void  execute_join();
+void  execute_prepared_join(uint32_t);
 void  create_rel_cleanup();
 
 
 int main(int argc, char **argv) {
-  relation_t RelR, RelS;
+  relation_t RelR = {0}, RelS = {0};
 
   /* Obtain System Information. */
   sys_info_prepare();
@@ -47,23 +60,139 @@ int main(int argc, char **argv) {
   RelS.size = 128*1000*100;     // 12.8M
   RelS.skew = 0.0;              // uniform distribution
   Threads.favor_physical_cores = true; // See meaning in ``util/threads.c``
+  Threads.use_all_llcs = false;        // i.e., --sched=tight
+  Threads.num_probes = 0;              // One-off join (no prepared R).
+  Threads.work_stealing = false;       // Model II in lockstep rounds.
+  Threads.morsel_probing = false;      // Each thread probes its own slice.
+  Threads.pipelined      = false;      // Model II without double-buffering.
+  Threads.overlap_partitioning = false; // Partition S, then R, then join.
+  Threads.huge_pages = false;          // See ``util/hugepage.c``
+  Threads.prefault   = false;
+  Threads.spin_limit       = 1 << 15;  // See sbarrier() in ``util/util.c``
+  Threads.spin_backoff_max = 64;
+  Threads.bench_barriers   = false;
+  Threads.cache_dir        = NULL;     // See ``util/relcache.c``
+  Threads.Dist.sparsity    = 1;        // Dense keys, [1, |R|].
+  Threads.Dist.match_rate  = 1.0;      // Each tuple of S has a match.
+  Threads.Dist.order       = 'r';      // Shuffled. See ``util/generate.c``
+  Threads.Dist.cluster     = 1024;
+  Threads.Dist.correlated  = false;
+  Threads.columnar         = false;    // Rows of (key, payload) tuples.
+  Threads.calibrate        = false;    // See ``util/calibrate.c``
+  Threads.profile_path     = ProfilePath;   // Per tuple width; see above.
 
   /* Extract command line parameters. */
   extract_cmd_args(argc, argv);
 
+  /* Machine profile (measured by --calibrate), if any, for the planner. */
+  profile_load();
+
+  /* Key-only tuples (see TUPLE_WIDTH in `types.h`) are a key column already. */
+  if(PAYLOAD_BYTES == 0) Threads.columnar = false;
+
+  /*
+   * Sizes of relations to be loaded from files (see `util/relfile.c`),
+   * including cached copies of relations to be generated (`util/relcache.c`).
+   */
+  relcache_prepare(&RelR);
+  if(RelR.path) relfile_open(&RelR);
+  relcache_prepare(&RelS); // (After R's size is known.)
+  if(RelS.path) relfile_open(&RelS);
+
+  /* Keys of generated relations span (array-based) tables; see below. */
+  if((!RelR.path || !RelS.path) && generated_max_key() >= UINT32_MAX) {
+    printf(">> Generated keys would exceed 2^32 - 1; reduce |R| or sparsity.\n");
+    exit(1);
+  }
+
   /* Assign each thread a CPU, and populate thread information. */
   prepare_threads_meta();
 
+  /* If requested, only benchmark the barriers. */
+  if(Threads.bench_barriers) {
+    barrier_benchmark();
+    prepare_threads_meta_cleanup();
+    sys_info_cleanup();
+    return 0;
+  }
+
+  /* If requested, only calibrate (and save the machine profile). */
+  if(Threads.calibrate) {
+    calibrate();
+    prepare_threads_meta_cleanup();
+    sys_info_cleanup();
+    return 0;
+  }
+
+  /* Generate (or load) input relations R and S. */
+  double mbs;
+  mbs = sizeof(tuple_t) * RelR.size/1024.0/1024.0;
+  printf("%s R [%.2f MiBs]. ", RelR.path ? "Loading" : "Creating", mbs);
+  fflush(stdout);
+  run_threads(create_R);
+
+  mbs = sizeof(tuple_t) * RelS.size/1024.0/1024.0;
+  printf("%s S [%.2f MiBs]. ", RelS.path ? "Loading" : "Creating", mbs);
+  fflush(stdout);
+  run_threads(create_S);
+  puts("Done.");
+
+  /* Save/cache them, if requested (before the join partitions them). */
+  for(relation_t *Rel = &RelR; Rel; Rel = (Rel == &RelR) ? &RelS : NULL) {
+    if(Rel->save_path && !relfile_write(Rel, Rel->save_path)) {
+      printf(">> Unable to write relation %c to ``%s``.\n", Rel->id,
+             Rel->save_path);
+      exit(1);
+    }
+
+    relcache_store(Rel);
+  }
+
+
   /*
-   * Calculate Radix.R and set the _initial_ Radix.S accordingly.
-   *
-   * For very small input (up to a small multiple of LLC size), run Model I.
-   * Otherwise, run Model II/III with f_R based on a large fraction of LLC size.
+   * Hash tables span all keys of R and S. Hence, keys (of up to 8 bytes; see
+   * TUPLE_WIDTH in `types.h`) are rebased to [0, max_key - min_key], whose
+   * range must be below 2^32 - 1. Checksums are reported for the original
+   * keys (see execute_join()).
    */
-  uint32_t ratiox = sizeof(bucket_t) * RelR.size / (SysInfo.llc_size * 6 / 5);
-  uint32_t ratio  = sizeof(bucket_t) * RelR.size / (SysInfo.llc_size * 2 / 3);
-  if(Radix.user_defined == false && ratiox >= 1)
-    Radix.R = Radix.S = lg_ceil(ratio);
+  uint64_t min_key = UINT64_MAX, max_key = 0;
+  for(uint32_t t = 0; t < Threads.N; t++) {
+    relation_t *SubR = Threads.Args[t].SubR, *SubS = Threads.Args[t].SubS;
+    if(SubR->size > 0) min_key = MIN(min_key, SubR->min_key);
+    if(SubS->size > 0) min_key = MIN(min_key, SubS->min_key);
+    max_key = MAX(max_key, SubR->max_key);
+    max_key = MAX(max_key, SubS->max_key);
+  }
+  if(min_key > max_key) min_key = 0; // No tuples.
+
+  if(max_key - min_key >= UINT32_MAX) {
+    printf(">> Key range must be below 2^32 - 1 (tables span [0, max_key - "
+           "min_key]).\n");
+    exit(1);
+  }
+
+  Threads.min_key = min_key;
+  Threads.max_key = max_key - min_key;
+
+  if(min_key > 0) {
+    printf("Rebasing keys by -%lu.\n", min_key);
+    run_threads(rebase_keys);
+  }
+
+  /*
+   * Select the model and the _initial_ fanouts (Radix.R, Radix.S) of least
+   * predicted cost, unless provided; see `join/plan.c`.
+   * Tables are array-based, i.e., span the keys' domain [0, max_key].
+   */
+  if(Radix.user_defined == false) plan_join();
+
+  /*
+   * ICP splits each block into one sub-block per LLC group, so the fanouts
+   * must be multiples of Threads.num_groups. Under --sched=loose especially,
+   * the number of utilized LLCs need not be a power of two; merge groups
+   * if so (or if the fanouts are smaller than the number of groups).
+   */
+  if(Radix.R > 0) threads_regroup(Radix.S > 0 ? MIN(FanoutR, FanoutS) : FanoutR);
 
   /* NOTE.
    * Skew estimation, and the potential selection of Model III, occur as
@@ -77,28 +206,21 @@ int main(int argc, char **argv) {
 
   /* Print threads/CPU mapping info. */
   printf("Running %d threads, pinned to %d "
-         "hyperthread(s)/core on %d LLC(s) [%.2f MiBs each].\n",
+         "hyperthread(s)/core on %d LLC(s) [%.2f MiBs each], %d group(s).\n",
          Threads.N, Threads.utilized_cpus_per_core,
-         Threads.utilized_llcs, SysInfo.llc_size/1024.0/1024.0);
-
-  /* Generate input relations R and S. */
-  double mbs;
-  mbs = sizeof(tuple_t) * RelR.size/1024.0/1024.0;
-  printf("Creating R [%.2f MiBs]. ", mbs); fflush(stdout);
-  run_threads(create_R);
-
-  mbs = sizeof(tuple_t) * RelS.size/1024.0/1024.0;
-  printf("Creating S [%.2f MiBs]. ", mbs); fflush(stdout);
-  run_threads(create_S);
-  puts("Done.");
-
+         Threads.utilized_llcs, SysInfo.llc_size/1024.0/1024.0,
+         Threads.num_groups);
 
   /* Run PolyHJ. */
-  execute_join();
+  if(Threads.num_probes == 0) execute_join();
+  else                        execute_prepared_join(Threads.num_probes);
+
+  if(Threads.huge_pages || Threads.prefault) huge_pages_report();
 
   /* Cleanup. */
   create_rel_cleanup();
   prepare_threads_meta_cleanup();
+  huge_pages_cleanup();
   sys_info_cleanup();
 
   return 0;
@@ -5,39 +5,138 @@
  *    # bucket_t
  *    # relation_t
  *
+ * > Arena Types:
+ *    # arena_t, arena_mark_t
+ *
  * > Threads Meta-Data Type:
  *    # thread_t
  *
  * > Global Parameters Types:
  *    # radix_info_t
  *    # params_t
+ *
+ * > Prepared Join Type:
+ *    # prepared_join_t
  */
 
 
 #ifndef __PolyHJ_TYPES_H__
   #define __PolyHJ_TYPES_H__
 
-  /* Tuples (as well as keys, payloads and buckets). */
-  typedef uint32_t   tkey_t;
-  typedef uint32_t   tpayload_t;
-  typedef tpayload_t bucket_t;
-  typedef struct { tkey_t key; tpayload_t payload; } tuple_t;
+  /*
+   * Tuples (as well as keys, payloads and buckets).
+   * Their width, in bytes, is fixed at compile time by TUPLE_WIDTH; the
+   * Makefile builds one binary per width (see --width in util/cmd_args.c):
+   *    4: 4-byte keys only (buckets then hold keys);
+   *    8: 4-byte keys and 4-byte payloads (default);
+   *   12: 8-byte keys and 4-byte payloads;
+   *   16: 8-byte keys and 8-byte payloads.
+   * Tuples are packed (to 4-byte alignment), so that 12-byte tuples are not
+   * padded to 16 bytes.
+   */
+  #ifndef TUPLE_WIDTH
+    #define TUPLE_WIDTH 8
+  #endif
+
+  #if   TUPLE_WIDTH == 4
+    #define KEY_BYTES 4
+    #define PAYLOAD_BYTES 0
+  #elif TUPLE_WIDTH == 8
+    #define KEY_BYTES 4
+    #define PAYLOAD_BYTES 4
+  #elif TUPLE_WIDTH == 12
+    #define KEY_BYTES 8
+    #define PAYLOAD_BYTES 4
+  #elif TUPLE_WIDTH == 16
+    #define KEY_BYTES 8
+    #define PAYLOAD_BYTES 8
+  #else
+    #error "TUPLE_WIDTH must be 4, 8, 12 or 16."
+  #endif
+
+  #if KEY_BYTES == 8
+    typedef uint64_t tkey_t;
+  #else
+    typedef uint32_t tkey_t;
+  #endif
+
+  #if PAYLOAD_BYTES == 8
+    typedef uint64_t tpayload_t;
+  #else
+    typedef uint32_t tpayload_t; // (Unused by key-only tuples.)
+  #endif
+
+  #if PAYLOAD_BYTES == 0
+    typedef tkey_t     bucket_t;
+    typedef struct { tkey_t key; } tuple_t;
+  #else
+    typedef tpayload_t bucket_t;
+    typedef struct __attribute__((packed, aligned(4))) {
+      tkey_t key; tpayload_t payload;
+    } tuple_t;
+  #endif
 
 
   /* Relations (and Sub-Relations). */
   typedef struct {
     tuple_t *tuples;
+    tkey_t     *keys;     // With --columnar, tuples are split into columns
+    tpayload_t *payloads; // (and `tuples` is NULL; see tuple_at()).
+                          // [Key-only tuples are always a column of keys.]
     uint32_t size;   // Number of tuples.
     uint32_t offset; // within parent relation (for sub-relations).
     uint32_t seed;
     double   skew;
     char     id;     // Relation 'R' or 'S'?
+    char    *path;      // File to load from, if not generated (see relfile.c).
+    char    *save_path; // File to save the generated relation to, if any.
+    bool     cached;    // `path` is a cached copy of the generated relation.
+    uint64_t min_key;   // Keys lie in [min_key, max_key] (per sub-relation;
+    uint64_t max_key;   // min_key may be any lower bound, e.g., zero).
+    uint64_t *histo;      // Counts of the keys' lowest `histo_bits` bits,
+    uint32_t  histo_bits; // if known (from the relation file; see relfile.c).
+    void    *mapping;      // Sub-relation's mapping of `path`, if mapped.
+    size_t   mapping_size;
+    void    *payload_mapping; // Mapping of payloads, if mapped as columns.
+    size_t   payload_mapping_size;
   } relation_t;
 
 
+  /* Synthetic Workload Parameters (see util/generate.c). */
+  typedef struct {
+    uint32_t sparsity;   // R's keys are spread over [1, sparsity * |R|].
+    double   match_rate; // Fraction of S's tuples that have a match in R.
+    char     order;      // Tuples are 'r'andom, 's'orted or 'c'lustered.
+    uint32_t cluster;    // Tuples per shuffled window, if clustered.
+    bool     correlated; // Payloads equal keys (else, positions plus one).
+  } dist_t;
+
+
+  /* Iterator over morsels of S (see morsel.c). */
+  typedef struct { uint32_t pass, k; } morsel_iter_t;
+
+
+  /* Per-thread Arena (see util/arena.c). */
+  typedef struct { void *p; size_t size; } spill_t;
+  typedef struct { size_t used; uint32_t num_spills; } arena_mark_t;
+  typedef struct {
+    char    *base;    // Chunk, on the owner thread's NUMA node.
+    size_t   size;    // Bytes in chunk.
+    size_t   used;    // Bump offset within chunk.
+    size_t   spilled; // Bytes currently allocated beyond the chunk.
+    size_t   peak;    // Maximum of used + spilled so far.
+    spill_t *Spills;  // Allocations beyond the chunk.
+    uint32_t num_spills, max_spills;
+  } arena_t;
+
+
   /* Block Data for ICP. */
   typedef struct { uint32_t start, end; } block_t;
-  typedef struct { uint32_t  N; block_t **Pos; } block_meta_t;
+  typedef struct {
+    uint32_t     N;
+    block_t    **Pos;
+    arena_mark_t mark; // Arena position before Pos (released by cleanup).
+  } block_meta_t;
 
 
   /* Thread Meta-data Type. */
@@ -60,6 +159,9 @@
 
     /* CPU-related Information. */
     cpu_t       *CPU;   // Info about thread's assigned CPU.
+
+    /* Scratch Memory (ICP data, group's Model II tables). */
+    arena_t      Arena;
   } thread_t;
 
 
@@ -79,15 +181,45 @@
     relation_t *RelS;    // Relation S.
     bucket_t  **HTables; // Shared Hash Table(s).
     bool        favor_physical_cores;
+    bool        use_all_llcs; // Spread threads across all LLCs.
+    uint32_t    num_probes; // # of S batches probed against a prepared R.
+    bool        work_stealing; // Model II via the dynamic scheduler.
+    bool        morsel_probing; // Models I/III probe S in claimed morsels.
+    bool        pipelined;     // Model II with double-buffered tables.
+    bool        overlap_partitioning; // Partition S during R's build.
+    bool        huge_pages; // Back relations and tables by huge pages.
+    bool        prefault;   // Pre-fault hash tables before the clock starts.
+    uint32_t    spin_limit;       // sbarrier(): max spins before sleeping.
+    uint32_t    spin_backoff_max; // sbarrier(): max PAUSEs per spin.
+    bool        bench_barriers;   // Only benchmark the barriers, then exit.
+    char       *cache_dir; // Cache generated relations here, if not NULL.
+    dist_t      Dist;      // Synthetic workload (of generated relations).
+    uint32_t    max_key;   // Largest key of R and S; tables span [0, max_key].
+    uint64_t    min_key;   // Keys were rebased by this much (see main.c).
+    bool        columnar;  // Relations as key and payload columns.
+    bool        calibrate;    // Only calibrate (see util/calibrate.c), then exit.
+    char       *profile_path; // Machine profile, loaded if it exists.
 
     /* Populated by prepare_threads_meta(). */
     thread_t   *Args;          // Threads Arguments.
     uint32_t    num_groups;    // # of groups for ColBP
-    uint32_t    utilized_llcs; // num_groups == utilized_llcs
+    uint32_t    utilized_llcs; // num_groups == utilized_llcs, unless regrouped
     uint32_t    utilized_cpus_per_core;
+    bool        oversubscribed; // More threads than hardware contexts?
   } params_t;
 
 
+  /* Prepared Join: R partitioned and built once, probed by many S batches. */
+  typedef struct {
+    bool       ready;      // true iff R is partitioned and tables are built.
+    uint32_t   radixR;     // Radix.R and Radix.S at preparation time.
+    uint32_t   radixS;
+    bucket_t **HTables;    // Resident hash table(s).
+    uint32_t   num_tables;
+    uint32_t   table_size; // # of buckets per table.
+  } prepared_join_t;
+
+
   /* Timer. */
   typedef struct timespec timespec;
   typedef struct { timespec checkpoint; double elapsed; } ttimer_t;
@@ -0,0 +1,136 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Per-thread Arena Allocator.
+ *
+ * Each thread owns an arena: one chunk of memory on the thread's NUMA node
+ * (via HugeAlloc(); see util/hugepage.c), from which ArenaAlloc() bumps
+ * cache-line-aligned allocations. Allocations are released in bulk, back to
+ * a mark taken earlier (arena_mark() / arena_release()), so the chunk is
+ * reused across phases and across joins without further allocator calls or
+ * page faults.
+ *
+ * Requests that do not fit the chunk "spill" into separate NodeAlloc()s,
+ * freed (NodeFree()) on release. Once an arena is released entirely, its chunk is
+ * regrown to the peak usage seen, so spilling happens once at most per size.
+ *
+ * An arena is used only by its owner thread, or by the main thread while
+ * the workers are idle; hence, no locking is needed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "common.h"
+
+/* Constants. */
+#define ArenaAlign     64         // Alignment of each allocation (bytes).
+#define ArenaChunkSize (1 << 22)  // Initial chunk size (bytes).
+
+
+/*
+ * Replaces the (empty) arena's chunk by one of at least `size` bytes.
+ * If --prefault, its pages are faulted right away.
+ */
+static void arena_grow(thread_t *T, size_t size) {
+  arena_t *A = &T->Arena;
+  assert(A->used == 0 && A->num_spills == 0);
+
+  HugeFree(A->base);
+
+  if(Threads.prefault) huge_reserve(size, T->CPU->node);
+  A->base = HugeAlloc(size, T->CPU->node);
+  A->size = size;
+}
+
+
+/*
+ * Allocates `size` bytes from T's arena.
+ */
+void* ArenaAlloc(thread_t *T, size_t size) {
+  arena_t *A = &T->Arena;
+  size = (MAX(size, 1) + ArenaAlign - 1) / ArenaAlign * ArenaAlign;
+
+  if(A->base == NULL) arena_grow(T, MAX(A->size, ArenaChunkSize));
+
+  /* Bump allocation. */
+  if(A->used + size <= A->size) {
+    void *p  = A->base + A->used;
+    A->used += size;
+    A->peak  = MAX(A->peak, A->used + A->spilled);
+    return p;
+  }
+
+  /* Spill. */
+  if(A->num_spills == A->max_spills) {
+    A->max_spills = MAX(2 * A->max_spills, 8);
+    A->Spills     = realloc(A->Spills, A->max_spills * sizeof(spill_t));
+    assert(A->Spills != NULL);
+  }
+
+  void *p = NodeAlloc(size, T->CPU->node);
+  A->Spills[A->num_spills++] = (spill_t){p, size};
+  A->spilled += size;
+  A->peak     = MAX(A->peak, A->used + A->spilled);
+
+  return p;
+}
+
+
+/*
+ * Returns the current position of T's arena.
+ */
+arena_mark_t arena_mark(thread_t *T) {
+  return (arena_mark_t){T->Arena.used, T->Arena.num_spills};
+}
+
+
+/*
+ * Releases all allocations of T's arena made after `mark`.
+ * Releasing to a mark beyond the current position has no effect; hence,
+ * nested regions may be released in any order.
+ */
+void arena_release(thread_t *T, arena_mark_t mark) {
+  arena_t *A = &T->Arena;
+
+  A->used = MIN(A->used, mark.used);
+
+  while(A->num_spills > mark.num_spills) {
+    spill_t *S  = A->Spills + (--A->num_spills);
+    A->spilled -= S->size;
+    NodeFree(S->p, S->size);
+  }
+
+  /* Once empty, regrow the chunk to fit the peak usage without spilling. */
+  if(A->used == 0 && A->num_spills == 0 && A->peak > A->size) {
+    HugeFree(A->base);
+    A->base = NULL;
+    A->size = A->peak; // (Allocated upon next ArenaAlloc().)
+  }
+}
+
+
+/*
+ * Ensures T's (empty) arena holds at least `size` bytes without spilling,
+ * e.g., to size and pre-fault it before a timed phase.
+ */
+void arena_reserve(thread_t *T, size_t size) {
+  arena_t *A = &T->Arena;
+  size = MAX(size, ArenaChunkSize);
+
+  if(A->base == NULL || A->size < size) arena_grow(T, MAX(size, A->size));
+}
+
+
+/*
+ * Frees T's arena.
+ */
+void arena_cleanup(thread_t *T) {
+  arena_t *A = &T->Arena;
+
+  arena_release(T, (arena_mark_t){0, 0});
+  HugeFree(A->base);
+  free(A->Spills);
+
+  *A = (arena_t){0};
+}
@@ -0,0 +1,435 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Hardware Calibration and Machine Profiles.
+ *
+ * (a) calibrate() measures, on Threads.N threads (placed as per --sched; by
+ *     default, all CPUs), the memory performance assumed by the planner (see
+ *     join/plan.c), sets the corresponding SysInfo items, and saves them to
+ *     the machine profile. Items do not depend on the number of threads that
+ *     later join (the planner shares aggregates among them):
+ *       # thread_bandwidth: sequential (read and write) streams beyond the
+ *         LLC, by one thread alone;
+ *       # llc_bandwidth, node_bandwidth: the same, aggregated over the threads
+ *         of each LLC, then of each NUMA node, in turn (means over LLCs and
+ *         nodes; limits, if all their CPUs are calibrated);
+ *       # llc_latency, mem_latency: chasing pointers (a random cycle of
+ *         cache lines) within half of the LLC, and within several times the
+ *         LLC (less the share of its lines that still hit the LLC);
+ *       # mem_parallelism: the latter, over the time per load of MaxChains
+ *         independent chases;
+ *       # tlb_entries, tlb_miss_latency: chasing one line per base page over
+ *         growing numbers of pages, less chasing as many adjacent lines; the
+ *         miss latency is the largest difference, and the reach the most
+ *         pages whose difference stays below a quarter of that;
+ *       # barrier_latency: sbarrier() across all threads;
+ *       # scatter_ns[r]: ICP-like partitioning (histogram, then scatter, of
+ *         ChunkSize blocks) with fanout 2^r, per tuple, by one thread alone
+ *         (the planner bounds it by the threads' share of bandwidth).
+ *     Chased buffers are advised as transparent huge pages (except for TLB
+ *     reach), so that page walks are not counted twice.
+ *
+ * (b) profile_load() reads the profile, if any, at startup: one "name value"
+ *     line per item. A profile measured with another LLC size or number of
+ *     CPUs, or (as scatter_ns depends on it) another tuple width, is ignored
+ *     (with a warning).
+ *
+ * The profile is Threads.profile_path (--profile; by default polyHJ.profile,
+ * or polyHJ-w.profile for the build of tuple width w, in the working
+ * directory; see main.c).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "common.h"
+
+/* Constants. */
+#define ChaseSteps    (1 << 21) // Dependent loads per latency measurement.
+#define StreamPasses  2
+#define BarrierRounds 2000
+#define TLBMinPages   16
+#define TLBMaxPages   (1 << 15)
+#define MaxChains     16        // Independent chases, for memory parallelism.
+
+/* Global Variables. */
+static volatile uint64_t Sink;
+static uint64_t          StreamBytes; // Streamed by participating threads.
+
+
+/*
+ * Returns line i of a chase through Buffer, of lines `stride` bytes apart
+ * (offset within their stride, so as to spread them over cache sets).
+ */
+static inline char *chase_line(char *Buffer, uint64_t i, uint64_t stride) {
+  return Buffer + i * stride + (i * SysInfo.line_size) % stride;
+}
+
+
+/*
+ * Returns the mean time, in ns, per load of `chains` independent pointer
+ * chases (at most MaxChains), along a random cycle through `lines` cache
+ * lines placed `stride` bytes apart in Buffer. For one chain, this is the
+ * latency of a load.
+ */
+static double chase_ns(char *Buffer, uint64_t lines, uint64_t stride,
+                       uint32_t chains)
+{
+  randgen_t G;
+  randgen_seed(&G, 12345, lines);
+
+  /* Sattolo's algorithm: a random permutation that is a single cycle. */
+  uint64_t *Order = SafeMalloc(lines * sizeof(uint64_t));
+  for(uint64_t i = 0; i < lines; i++) Order[i] = i;
+  for(uint64_t i = lines - 1; i > 0; i--) {
+    uint64_t j = ((uint64_t)xorshift128(&G) << 32 | xorshift128(&G)) % i;
+    uint64_t x = Order[i]; Order[i] = Order[j]; Order[j] = x;
+  }
+
+  /* Line Order[i] points to line Order[i+1] (and the last one to the first).
+   * Chains start evenly spaced along the cycle. */
+  for(uint64_t i = 0; i < lines; i++) {
+    *(char**)chase_line(Buffer, Order[i], stride) =
+      chase_line(Buffer, Order[(i + 1) % lines], stride);
+  }
+
+  char *P[MaxChains];
+  for(uint32_t c = 0; c < chains; c++) {
+    P[c] = chase_line(Buffer, Order[c * lines / chains], stride);
+  }
+  free(Order);
+
+  /* Warm up (one lap, at most ChaseSteps), then measure. */
+  for(uint64_t s = 0; s < MIN(lines, ChaseSteps); s++) P[0] = *(char**)P[0];
+
+  ttimer_t timer;
+  timer_start(&timer);
+  for(uint32_t s = 0; s < ChaseSteps / chains; s++) {
+    for(uint32_t c = 0; c < chains; c++) P[c] = *(char**)P[c];
+  }
+  timer_stop(&timer);
+
+  for(uint32_t c = 0; c < chains; c++) Sink += (uint64_t)P[c];
+  return timer.elapsed * 1000.0 / (ChaseSteps / chains * chains);
+}
+
+
+/*
+ * Returns a buffer of `size` bytes (to be free()d), advised as transparent
+ * huge pages if `huge`, or as base pages otherwise.
+ */
+static char *chase_buffer(size_t size, bool huge) {
+  char *p = PageAlignedAlloc(size);
+  madvise(p, size, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+  memset(p, 0, size);
+  return p;
+}
+
+
+/*
+ * Streams (reads and writes) Buffer, of `size` bytes, StreamPasses times.
+ */
+static void stream(uint64_t *Buffer, size_t size) {
+  for(uint32_t pass = 0; pass < StreamPasses; pass++) {
+    for(size_t i = 0; i < size / sizeof(uint64_t); i++) Buffer[i]++;
+  }
+
+  __sync_fetch_and_add(&StreamBytes, 2 * StreamPasses * size);
+}
+
+
+/*
+ * Measures sequential bandwidth, in bytes/ns, of the threads for which
+ * part(T, which) holds, for each `which` below `count`; returns the mean.
+ */
+static double bandwidth(thread_t *T, uint64_t *Buffer, size_t size,
+                        bool (*part)(thread_t*, uint32_t), uint32_t count)
+{
+  double   sum = 0;
+  uint32_t measured = 0;
+  ttimer_t timer;
+
+  for(uint32_t which = 0; which < count; which++) {
+    if(T->tid == 0) StreamBytes = 0;
+    barrier();
+    if(T->tid == 0) timer_start(&timer);
+
+    if(part(T, which)) stream(Buffer, size);
+
+    barrier();
+    if(T->tid == 0) {
+      timer_stop(&timer);
+      if(StreamBytes > 0) {
+        sum += StreamBytes / (timer.elapsed * 1000.0);
+        measured++;
+      }
+    }
+  }
+
+  return measured ? sum / measured : 0;
+}
+
+static bool alone  (thread_t *T, uint32_t which) { return T->tid == which; }
+static bool on_llc (thread_t *T, uint32_t llc)  { return T->CPU->llc  == llc;  }
+static bool on_node(thread_t *T, uint32_t node) { return T->CPU->node == node; }
+
+
+/*
+ * Returns the time, in ns per tuple, of partitioning Tuples (of `count`)
+ * into Out with fanout 2^radix, by blocks of ChunkSize, as ICP() does.
+ */
+static double scatter(tuple_t *Tuples, tuple_t *Out, uint32_t count,
+                      uint32_t radix, uint32_t *Histo)
+{
+  uint32_t fanout = 1 << radix, mask = fanout - 1;
+  ttimer_t timer;
+  timer_start(&timer);
+
+  for(uint32_t from = 0; from < count; from += ChunkSize) {
+    uint32_t to = MIN(from + ChunkSize, count);
+
+    memset(Histo, 0, fanout * sizeof(uint32_t));
+    for(uint32_t j = from; j < to; j++) ++Histo[ HASH(Tuples[j].key, mask) ];
+
+    uint32_t accum = from;
+    for(uint32_t j = 0; j < fanout; j++) {
+      uint32_t pre_accum = Histo[j];
+      Histo[j] = accum;
+      accum += pre_accum;
+    }
+
+    for(uint32_t j = from; j < to; j++) {
+      tuple_t t = Tuples[j];
+      Out[ Histo[ HASH(t.key, mask) ]++ ] = t;
+    }
+  }
+
+  timer_stop(&timer);
+  return timer.elapsed * 1000.0 / count;
+}
+
+
+
+/*
+ * Thread function for calibrate().
+ */
+static void *calibrate_thread(void* params) {
+  thread_t *T   = (thread_t*)params;
+  uint32_t  tid = T->tid;
+  ttimer_t  timer;
+
+  /* Sequential bandwidth, per LLC, then per NUMA node. */
+  uint32_t threads_per_llc = 0;
+  for(uint32_t t = 0; t < Threads.N; t++) {
+    threads_per_llc += (Threads.Args[t].CPU->llc == T->CPU->llc);
+  }
+
+  size_t size = MIN(MAX(2 * SysInfo.llc_size / threads_per_llc, 16 << 20),
+                    256 << 20);
+
+  uint64_t *Buffer = NodeAlloc(size, T->CPU->node);
+  memset(Buffer, 0, size);
+
+  double thread_bandwidth = bandwidth(T, Buffer, size, alone, 1);
+  double llc_bandwidth  = bandwidth(T, Buffer, size, on_llc,  SysInfo.num_llcs);
+  double node_bandwidth = bandwidth(T, Buffer, size, on_node,
+                                    SysInfo.num_nodes);
+  NodeFree(Buffer, size);
+
+  /* Scatter throughput versus fanout, by thread zero alone. */
+  barrier();
+  if(tid == 0) {
+    uint32_t count  = MIN(MAX(2 * SysInfo.llc_size / sizeof(tuple_t),
+                              1 << 20), 1 << 24);
+    tuple_t *Tuples = NodeAlloc(count * sizeof(tuple_t), T->CPU->node);
+    tuple_t *Out    = NodeAlloc(count * sizeof(tuple_t), T->CPU->node);
+    uint32_t *Histo = SafeMalloc((1 << (CALIBRATED_RADICES - 1))
+                                 * sizeof(uint32_t));
+
+    randgen_t G;
+    randgen_seed(&G, 54321, tid);
+    for(uint32_t i = 0; i < count; i++) {
+      Tuples[i] = make_tuple(xorshift128(&G), i);
+      Out[i]    = Tuples[i];
+    }
+
+    for(uint32_t r = 1; r < CALIBRATED_RADICES; r++) {
+      SysInfo.scatter_ns[r] = scatter(Tuples, Out, count, r, Histo);
+    }
+
+    free(Histo);
+    NodeFree(Out, count * sizeof(tuple_t));
+    NodeFree(Tuples, count * sizeof(tuple_t));
+  }
+
+  /* Barrier cost, across all threads. */
+  barrier();
+  if(tid == 0) timer_start(&timer);
+  for(uint32_t r = 0; r < BarrierRounds; r++) sbarrier(tid);
+  if(tid == 0) {
+    timer_stop(&timer);
+    SysInfo.barrier_latency = timer.elapsed * 1000.0 / BarrierRounds;
+  }
+
+  /* Latencies and TLB reach, by thread zero alone. */
+  barrier();
+  if(tid != 0) return NULL;
+
+  SysInfo.thread_bandwidth = thread_bandwidth;
+  SysInfo.llc_bandwidth    = llc_bandwidth;
+  SysInfo.node_bandwidth   = node_bandwidth;
+
+  uint64_t line = SysInfo.line_size;
+  size_t   in   = SysInfo.llc_size / 2;
+  size_t   out  = MIN(4 * SysInfo.llc_size, (size_t)1 << 30);
+
+  char *Chase = chase_buffer(out, true);
+  SysInfo.llc_latency = chase_ns(Chase, in / line, line, 1);
+
+  double hit = (double)SysInfo.llc_size / out;
+  double ns  = chase_ns(Chase, out / line, line, 1);
+  if(hit < 1) { // (Otherwise, an LLC of 256MiBs or more keeps the nominal.)
+    SysInfo.mem_latency = MAX((ns - hit * SysInfo.llc_latency) / (1 - hit),
+                              SysInfo.llc_latency);
+  }
+
+  SysInfo.mem_parallelism = MAX(ns / chase_ns(Chase, out / line, line,
+                                              MaxChains), 1.0);
+  free(Chase);
+
+  uint64_t page  = SysInfo.base_page_size;
+  double   Penalty[32] = {0}, max_penalty = 0;
+  uint32_t steps = 0;
+
+  Chase = chase_buffer(TLBMaxPages * page, false);
+  for(uint64_t pages = TLBMinPages; pages <= TLBMaxPages; pages *= 2) {
+    double spread = chase_ns(Chase, pages, page, 1);
+    double packed = chase_ns(Chase, pages, line, 1);
+    Penalty[steps] = MAX(spread - packed, 0);
+    max_penalty    = MAX(max_penalty, Penalty[steps]);
+    steps++;
+  }
+  free(Chase);
+
+  SysInfo.tlb_miss_latency = max_penalty;
+  SysInfo.tlb_entries      = TLBMinPages;
+  for(uint32_t s = 0; s < steps && Penalty[s] < max_penalty / 4; s++) {
+    SysInfo.tlb_entries = TLBMinPages << s;
+  }
+
+  return NULL;
+}
+
+
+
+/*
+ * Measures the machine's memory performance (see above), reports it and
+ * saves it to the machine profile.
+ */
+void calibrate() {
+  printf("Calibrating: %u threads, %u LLC(s), %u NUMA node(s).\n",
+         Threads.N, SysInfo.num_llcs, SysInfo.num_nodes);
+  run_threads(calibrate_thread);
+
+  printf("Bandwidth: %.2f GB/s per thread, %.2f GB/s per LLC, %.2f GB/s per "
+         "NUMA node.\n", SysInfo.thread_bandwidth, SysInfo.llc_bandwidth,
+         SysInfo.node_bandwidth);
+  printf("Latency: %.1f ns within LLC, %.1f ns beyond (%.1f in flight). "
+         "TLB: %u entries, %.1f ns per miss. Barrier: %.2f usec.\n",
+         SysInfo.llc_latency, SysInfo.mem_latency, SysInfo.mem_parallelism,
+         SysInfo.tlb_entries,
+         SysInfo.tlb_miss_latency, SysInfo.barrier_latency / 1000.0);
+  printf("Scatter (ns/tuple, fanout 2^1..2^%u):", CALIBRATED_RADICES - 1);
+  for(uint32_t r = 1; r < CALIBRATED_RADICES; r++) {
+    printf(" %.2f", SysInfo.scatter_ns[r]);
+  }
+  puts(".");
+
+  FILE *file = fopen(Threads.profile_path, "w");
+  if(!file) {
+    printf(">> Unable to write machine profile ``%s``.\n", Threads.profile_path);
+    exit(1);
+  }
+
+  fprintf(file, "# PolyHJ machine profile (see util/calibrate.c).\n");
+  fprintf(file, "llc_size %lu\n",         SysInfo.llc_size);
+  fprintf(file, "num_cpus %u\n",          SysInfo.num_cpus);
+  fprintf(file, "tuple_width %zu\n",      sizeof(tuple_t));
+  fprintf(file, "thread_bandwidth %.6f\n", SysInfo.thread_bandwidth);
+  fprintf(file, "llc_bandwidth %.6f\n",    SysInfo.llc_bandwidth);
+  fprintf(file, "node_bandwidth %.6f\n",   SysInfo.node_bandwidth);
+  fprintf(file, "llc_latency %.6f\n",      SysInfo.llc_latency);
+  fprintf(file, "mem_latency %.6f\n",      SysInfo.mem_latency);
+  fprintf(file, "mem_parallelism %.6f\n",  SysInfo.mem_parallelism);
+  fprintf(file, "tlb_entries %u\n",        SysInfo.tlb_entries);
+  fprintf(file, "tlb_miss_latency %.6f\n", SysInfo.tlb_miss_latency);
+  fprintf(file, "barrier_latency %.6f\n",  SysInfo.barrier_latency);
+  for(uint32_t r = 1; r < CALIBRATED_RADICES; r++) {
+    fprintf(file, "scatter_ns %u %.6f\n", r, SysInfo.scatter_ns[r]);
+  }
+
+  fclose(file);
+  printf("Saved machine profile ``%s``.\n", Threads.profile_path);
+}
+
+
+/*
+ * Sets SysInfo's memory performance items from the machine profile, if any.
+ */
+void profile_load() {
+  char     buffer[LINEMAX], name[LINEMAX];
+  double   value;
+  uint32_t r, width = 0;
+  sys_info_t Profile = SysInfo;
+
+  FILE *file = fopen(Threads.profile_path, "r");
+  if(!file) return;
+
+  while(fgets(buffer, LINEMAX, file)) {
+    if(sscanf(buffer, "scatter_ns %u %lf", &r, &value) == 2) {
+      if(r < CALIBRATED_RADICES) Profile.scatter_ns[r] = value;
+    }
+    else if(sscanf(buffer, "%s %lf", name, &value) == 2) {
+      if     (!strcmp(name, "llc_size"))    Profile.llc_size    = value;
+      else if(!strcmp(name, "num_cpus"))    Profile.num_cpus    = value;
+      else if(!strcmp(name, "tuple_width")) width               = value;
+      else if(!strcmp(name, "thread_bandwidth")) {
+        Profile.thread_bandwidth = value;
+      }
+      else if(!strcmp(name, "llc_bandwidth"))  Profile.llc_bandwidth  = value;
+      else if(!strcmp(name, "node_bandwidth")) Profile.node_bandwidth = value;
+      else if(!strcmp(name, "llc_latency"))    Profile.llc_latency    = value;
+      else if(!strcmp(name, "mem_latency"))    Profile.mem_latency    = value;
+      else if(!strcmp(name, "mem_parallelism")) {
+        Profile.mem_parallelism = value;
+      }
+      else if(!strcmp(name, "tlb_entries"))    Profile.tlb_entries    = value;
+      else if(!strcmp(name, "tlb_miss_latency")) {
+        Profile.tlb_miss_latency = value;
+      }
+      else if(!strcmp(name, "barrier_latency")) {
+        Profile.barrier_latency = value;
+      }
+    }
+  }
+
+  fclose(file);
+
+  if(Profile.llc_size != SysInfo.llc_size ||
+     Profile.num_cpus != SysInfo.num_cpus)
+  {
+    printf("Warning: Ignoring machine profile ``%s`` of another machine "
+           "(rerun --calibrate).\n", Threads.profile_path);
+    return;
+  }
+
+  if(width != sizeof(tuple_t)) {
+    printf("Warning: Ignoring machine profile ``%s`` of %u-byte tuples "
+           "(rerun --calibrate).\n", Threads.profile_path, width);
+    return;
+  }
+
+  SysInfo = Profile;
+}
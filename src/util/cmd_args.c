@@ -5,22 +5,83 @@
  *   (b) --r, --s:  Number of tuples in relations R and S
  *   (c) --skew:    Zipfian skew factor for relation S
  *   (d) --radix, --radixR, --radixS: Set both/one fanout(s) to 2^r for given r
- *   (e) --favor_hyperthreading (flag)
- *   (f) --sched:   TODO.
- *   (g) --help:    TODO.
+ *   (e) --sched:   Thread placement policy: tight, loose or hypertight
+ *   (f) --probes:  Number of S batches to probe against a prepared R
+ *   (g) --work_stealing (flag): Schedule Model II's partitions dynamically
+ *   (h) --morsels (flag): Probe S in dynamically claimed morsels (I, III)
+ *   (i) --pipelined (flag): Overlap Model II's build and probe rounds
+ *       [--work_stealing and --pipelined are mutually exclusive]
+ *   (j) --overlap (flag): Partition S during Model II's build phase
+ *   (k) --hugepages (flag): Back relations and hash tables by huge pages
+ *   (l) --prefault (flag): Pre-fault hash tables before timing the join
+ *   (m) --spin, --backoff: sbarrier() spin limit and maximum backoff
+ *   (n) --bench_barriers (flag): Benchmark barriers, then exit
+ *   (o) --load_r, --load_s: Load R or S from a binary or CSV relation file
+ *   (p) --save_r, --save_s: Save the generated R or S to a binary file
+ *   (q) --cache[=dir]: Reuse generated relations cached in dir (/dev/shm)
+ *   (r) Synthetic workloads (see util/generate.c):
+ *       --sparsity: Spread R's keys over a domain this many times |R|
+ *       --match:    Fraction of S's tuples that have a match in R
+ *       --order:    Tuple order: shuffled, sorted or clustered
+ *       --cluster:  Tuples per (shuffled) window of clustered order
+ *       --correlated (flag): Payloads equal keys (instead of row ids)
+ *   (s) --columnar (flag): Lay out relations as key and payload columns
+ *   (t) --width:   Tuple width in bytes: 4 (key-only), 8, 12 or 16 [runs the
+ *                  build for that width; see select_tuple_width()]
+ *   (u) --calibrate (flag): Measure the machine, save its profile, then exit
+ *       --profile: Machine profile file (polyHJ.profile, or polyHJ-w.profile
+ *                  for tuple width w), loaded if present
+ *   (v) --help:    TODO.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "common.h"
 
+
+/*
+ * If --width=w selects another tuple width than this build's (TUPLE_WIDTH;
+ * see types.h), replaces this process by the build for w, i.e., polyHJ-w
+ * (or polyHJ, for w = 8) next to this executable, with the same arguments.
+ */
+static void select_tuple_width(int argc, char **argv) {
+  uint32_t width = TUPLE_WIDTH;
+  char     path[LINEMAX];
+
+  for(uint32_t i = 1; i < argc; i++) sscanf(argv[i], "--width=%u", &width);
+  if(width == TUPLE_WIDTH) return;
+
+  if(width != 4 && width != 8 && width != 12 && width != 16) {
+    printf(">> Unsupported tuple width %u (4, 8, 12 or 16 bytes).\n", width);
+    exit(1);
+  }
+
+  ssize_t n = readlink("/proc/self/exe", path, LINEMAX - 16);
+  assert(n > 0);
+  path[n] = '\0';
+
+  char *name = strrchr(path, '/') + 1;
+  if(width == 8) sprintf(name, "polyHJ");
+  else           sprintf(name, "polyHJ-%u", width);
+
+  execv(path, argv);
+
+  printf(">> Unable to run ``%s`` for --width=%u.\n", path, width);
+  exit(1);
+}
+
+
 void extract_cmd_args(int argc, char **argv) {
   char buffer[LINEMAX];
   uint32_t ival;
   double   dval;
   char c;
 
+  // Run the build for the requested tuple width, if not this one.
+  select_tuple_width(argc, argv);
+
   // False indicates user has not supplied --radix, --radixR or --radixS (yet).
   Radix.user_defined = false;
 
@@ -69,23 +130,146 @@ void extract_cmd_args(int argc, char **argv) {
         Radix.S = ival;
       }
 
+      else if(!strcmp(buffer, "probes") && sscanf(argv[i], "%u", &ival)) {
+        Threads.num_probes = ival;
+      }
+
       else if(!strcmp(buffer, "sched")) {
-        // TODO:
-        // > Read one character off supplied value.
-        // > If h (i.e., hypertight), set Threads.favor_physical_cores to false
-        // > If l (i.e., loose), set Threads.use_all_llcs to true [create it.]
-        // > If t (i.e., tight), do nothing -- that's the default.
-        // > Otherwise, report error.
-        // > Remove option --favor_hyperthreading. Becomes redundant.
-        printf("TODO.\n");
-        exit(0);
+        // The first character of the value selects the policy.
+        c = argv[i][0];
+        // See prepare_threads_meta() in ``util/threads.c`` for details.
+        if(c == 'h') {        // Hypertight.
+          Threads.favor_physical_cores = false;
+          Threads.use_all_llcs         = false;
+        }
+        else if(c == 'l') {   // Loose.
+          Threads.favor_physical_cores = true;
+          Threads.use_all_llcs         = true;
+        }
+        else if(c == 't') {   // Tight [default].
+          Threads.favor_physical_cores = true;
+          Threads.use_all_llcs         = false;
+        }
+        else {
+          printf(">> Unrecognized policy ``%s`` for option ``sched``.\n",
+                 argv[i]);
+          exit(1);
+        }
+      }
+
+      else if(!strcmp(buffer, "work_stealing")) {
+        Threads.work_stealing = true;
+        // Groups claim (partition, table) tasks dynamically and steal from
+        // other groups, instead of processing partitions in lockstep.
+      }
+
+      else if(!strcmp(buffer, "morsels")) {
+        Threads.morsel_probing = true;
+        // Threads claim fixed-size ranges of S, instead of probing exactly
+        // their own sub-relation.
+      }
+
+      else if(!strcmp(buffer, "pipelined")) {
+        Threads.pipelined = true;
+        // Double-buffered tables: build round i+1 while probing round i,
+        // synchronizing per table instead of with barriers.
+      }
+
+      else if(!strcmp(buffer, "overlap")) {
+        Threads.overlap_partitioning = true;
+        // Each thread partitions its own S while others still build from R,
+        // instead of all threads partitioning S before R.
+      }
+
+      else if(!strcmp(buffer, "hugepages")) {
+        Threads.huge_pages = true;
+        // hugetlbfs pages if free, else transparent huge pages (if enabled).
+      }
+
+      else if(!strcmp(buffer, "prefault")) {
+        Threads.prefault = true;
+        // Page faults of the hash tables are then taken before the clock.
+      }
+
+      else if(!strcmp(buffer, "spin") && sscanf(argv[i], "%u", &ival)) {
+        Threads.spin_limit = ival;
       }
 
-      else if(!strcmp(buffer, "favor_hyperthreading")) {
-        Threads.favor_physical_cores = false;
-        // This option means the following:
-        // When assigning threads to CPUs, favor using hyperthreads on few
-        // LLC(s) over assigning threads to physical cores across more LLC(s).
+      else if(!strcmp(buffer, "backoff") && sscanf(argv[i], "%u", &ival)) {
+        Threads.spin_backoff_max = MAX(ival, 1);
+      }
+
+      else if(!strcmp(buffer, "bench_barriers")) {
+        Threads.bench_barriers = true;
+      }
+
+      else if(!strcmp(buffer, "load_r") && argv[i][0] != '\0') {
+        Threads.RelR->path = argv[i];
+        // See ``util/relfile.c`` for the format.
+      }
+
+      else if(!strcmp(buffer, "load_s") && argv[i][0] != '\0') {
+        Threads.RelS->path = argv[i];
+      }
+
+      else if(!strcmp(buffer, "save_r") && argv[i][0] != '\0') {
+        Threads.RelR->save_path = argv[i];
+      }
+
+      else if(!strcmp(buffer, "save_s") && argv[i][0] != '\0') {
+        Threads.RelS->save_path = argv[i];
+      }
+
+      else if(!strcmp(buffer, "cache")) {
+        Threads.cache_dir = (argv[i][0] != '\0') ? argv[i] : "/dev/shm";
+        // See ``util/relcache.c``.
+      }
+
+      else if(!strcmp(buffer, "sparsity") && sscanf(argv[i], "%u", &ival)) {
+        Threads.Dist.sparsity = MAX(ival, 1);
+      }
+
+      else if(!strcmp(buffer, "match") && sscanf(argv[i], "%lf", &dval)) {
+        Threads.Dist.match_rate = MIN(MAX(dval, 0.0), 1.0);
+      }
+
+      else if(!strcmp(buffer, "order")) {
+        if(!strcmp(argv[i], "shuffled"))       Threads.Dist.order = 'r';
+        else if(!strcmp(argv[i], "sorted"))    Threads.Dist.order = 's';
+        else if(!strcmp(argv[i], "clustered")) Threads.Dist.order = 'c';
+        else {
+          printf(">> Unrecognized order ``%s`` for option ``order``.\n",
+                 argv[i]);
+          exit(1);
+        }
+      }
+
+      else if(!strcmp(buffer, "cluster") && sscanf(argv[i], "%u", &ival)) {
+        Threads.Dist.cluster = MAX(ival, 1);
+        Threads.Dist.order   = 'c';
+      }
+
+      else if(!strcmp(buffer, "correlated")) {
+        Threads.Dist.correlated = true;
+      }
+
+      else if(!strcmp(buffer, "columnar")) {
+        Threads.columnar = true;
+        // ICP's histogram and the probes then read keys only; payloads are
+        // only moved by ICP and gathered by builds.
+      }
+
+      else if(!strcmp(buffer, "calibrate")) {
+        Threads.calibrate = true;
+        // See ``util/calibrate.c``.
+      }
+
+      else if(!strcmp(buffer, "profile") && argv[i][0] != '\0') {
+        Threads.profile_path = argv[i];
+      }
+
+      else if(!strcmp(buffer, "width")) {
+        // Handled by select_tuple_width().
       }
 
       else if(!strcmp(buffer, "h") || !strcmp(buffer, "help")) {
@@ -98,5 +282,11 @@ void extract_cmd_args(int argc, char **argv) {
       }
   }
 
+  // Model II schedules its rounds either dynamically or pipelined, not both.
+  if(Threads.work_stealing && Threads.pipelined) {
+    printf(">> Options ``work_stealing`` and ``pipelined`` are exclusive.\n");
+    exit(1);
+  }
+
   return;
 }
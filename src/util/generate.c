@@ -6,7 +6,37 @@
  * (a) Thread Functions that allocate, generate and NUMA-distribute relations.
  *     These can be used as input to run_threads().
  *
- * (b) Generation Functions that produce uniform R, uniform S and skewed S.
+ * (b) Generation Functions that produce uniform R, uniform S and skewed S,
+ *     shaped by the workload parameters of Threads.Dist (see below).
+ *
+ * Each thread allocates (on its NUMA node) and generates its own sub-relation
+ * directly, thus also first-touching it; no thread generates, and no thread
+ * copies, more than its share:
+ *   # Key permutations are computed per position, by a keyed Feistel network
+ *     over [0, N) (see permute()), rather than by a serial shuffle.
+ *   # Random draws (skewed S) are split into blocks of `GenBlock` tuples,
+ *     each drawn from its own random stream (see randgen_seed()), and each
+ *     sampled in O(1) (see zipf_sample()).
+ * Hence, a relation is determined by its seed alone, whatever the number of
+ * threads.
+ *
+ * Workloads. Tuples of R are keyed by ranks [0, |R|), which S references
+ * (uniformly, or following a Zipf distribution):
+ *   # Sparse keys (--sparsity=d): rank j has key j * d + 1 + o, for a random
+ *     offset o < d; R's keys are thus spread over [1, d * |R|].
+ *   # Match rate (--match=m): each S tuple references its rank's key with
+ *     probability m, and a key absent from R otherwise: another key within
+ *     the rank's d-wide range, or (if dense) |R| + 1 + rank.
+ *   # Order (--order): ranks are shuffled across the whole relation (each
+ *     |R|-sized segment of S), sorted, or clustered, i.e., sorted across
+ *     windows of --cluster tuples yet shuffled within each. Skewed S is
+ *     always shuffled.
+ *   # Payloads (--correlated): the key, or else the tuple's position plus
+ *     one (a row id). Payloads of R are thus never zero (see buildprobe_I.c).
+ *
+ * Tuples are laid out as rows, or (--columnar) as a key and a payload column.
+ *
+ * A relation with a `path` is loaded from that file instead (see relfile.c).
  */
 
 #include <stdlib.h>
@@ -16,67 +46,123 @@
 
 #include "common.h"
 
-/* Global Variables. */
-static randgen_t G;
-static bool      create_R_first = true;
+/* Constants. */
+#define GenBlock      (1 << 16) // Tuples per random stream.
+#define FeistelRounds 4
+
+/* Keyed Pseudo-random Permutation of [0, N). */
+typedef struct {
+  uint64_t N;
+  uint32_t half_bits;  // Each half of the (square) Feistel domain.
+  uint64_t Keys[FeistelRounds];
+} permutation_t;
+
+/* Ranks by Position, per Threads.Dist.order (see order_rank()). */
+typedef struct {
+  permutation_t P;
+  uint64_t      N, seed, window; // P permutes `window`, if clustered.
+} order_t;
+
+/* Zipf Sampler (see zipf_sample()). */
+typedef struct {
+  uint64_t N;
+  double   z;
+  double   H1, HN, s; // H(1.5) - 1, H(N + 0.5), and the squeeze threshold.
+} zipf_t;
 
 /* Generation Functions Declarations. */
-void fill_primary_keys(relation_t*);
-void fill_skewed_keys (relation_t*, relation_t*);
-void fill_foreign_keys(relation_t*, relation_t*);
+void fill_primary_keys(relation_t*, relation_t*);
+void fill_skewed_keys (relation_t*, relation_t*, relation_t*);
+void fill_foreign_keys(relation_t*, relation_t*, relation_t*);
 
 
 /*
  * Allocates, generates and NUMA-distributes a given relation.
- * NOTE: Frees Rel->tuples.
  */
 void create_rel(uint32_t tid, relation_t *Rel, relation_t *Sub) {
   char id = Rel->id; // Relation 'R' or 'S'?
 
-  /* Allocate relation. */
-  if(tid == 0) Rel->tuples = PageAlignedAlloc(Rel->size * sizeof(tuple_t));
+  /* Map own sub-relation from file, if given. */
+  if(Rel->path) { relfile_map(tid, Rel, Sub); return; }
 
-  /* NUMA Distribute [important, even as we localize below]. */
-  barrier();
-  memset(Rel->tuples + Sub->offset, 0, sizeof(tuple_t) * Sub->size);
-  barrier();
+  /* Allocate own sub-relation on own node (first-touched by generation). */
+  sub_alloc(tid, Sub);
 
-  /* Fill in a shuffled array of tuples. */
-  if(tid == 0 && id == 'R') fill_primary_keys(Rel);
-  if(tid == 0 && id == 'S') {
-    if(Rel->skew > 0.0) fill_skewed_keys (Threads.RelR, Threads.RelS);
-    else                fill_foreign_keys(Threads.RelR, Threads.RelS);
-  }
+  if(id == 'R')            fill_primary_keys(Rel, Sub);
+  else if(Rel->skew > 0.0) fill_skewed_keys(Threads.RelR, Rel, Sub);
+  else                     fill_foreign_keys(Threads.RelR, Rel, Sub);
 
-  // All threads wait for thread zero's generation of relation.
-  barrier();
+  Sub->min_key = 0; // (A lower bound; generated keys need no rebasing.)
+  Sub->max_key = generated_max_key();
 
-  /* NUMA Localize. */
-  for(int t = Threads.N - 1; t >= 0; t--) {
-    if(t == tid) {
-      Sub->tuples = SafeMalloc(sizeof(tuple_t) * Sub->size);
-      memcpy(Sub->tuples, Rel->tuples + Sub->offset, sizeof(tuple_t)*Sub->size);
-      Rel->tuples = realloc(Rel->tuples, Sub->offset * sizeof(tuple_t));
-    }
+  return;
+}
 
-    barrier();
+
+/*
+ * Subtracts Threads.min_key from Sub's keys (see main.c).
+ */
+static void rebase_sub(relation_t *Sub) {
+  if(Threads.min_key == 0) return;
+
+  for(uint32_t i = 0; i < Sub->size; i++) {
+    tuple_t t = tuple_at(Sub, i);
+    t.key    -= Threads.min_key;
+    tuple_set(Sub, i, t);
   }
+}
 
 
-  return;
+/*
+ * Thread function to rebase the keys of own sub-relations of R and S.
+ */
+void *rebase_keys(void* params) {
+  thread_t *T = (thread_t*)params;
+
+  rebase_sub(T->SubR);
+  rebase_sub(T->SubS);
+
+  return NULL;
+}
+
+
+/*
+ * Allocates Sub's tuples, or its columns (--columnar), on thread tid's node.
+ * Columns share one allocation: the keys, then the payloads.
+ */
+void sub_alloc(uint32_t tid, relation_t *Sub) {
+  void *p = HugeAlloc(sizeof(tuple_t) * Sub->size, Threads.Args[tid].CPU->node);
+
+  Sub->tuples   = Threads.columnar ? NULL : p;
+  Sub->keys     = Threads.columnar ? p : NULL;
+  Sub->payloads = Threads.columnar ? (tpayload_t*)(Sub->keys + Sub->size)
+                                   : NULL;
+}
+
+
+/*
+ * Frees (or unmaps) a sub-relation created by create_rel().
+ */
+static void free_sub(relation_t *Sub) {
+  if(Sub->mapping)     relfile_unmap(Sub);
+  else if(Sub->tuples) HugeFree(Sub->tuples);
+  else                 HugeFree(Sub->keys);
 }
 
 
 /*
  * Frees the allocations by create_rel().
- * Note that Threads.RelR->tuples and Threads.RelS->tuples are freed by
- * realloc().
  */
 void create_rel_cleanup() {
   for(uint32_t t = 0; t < Threads.N; t++) {
-    free(Threads.Args[t].SubR->tuples);
-    free(Threads.Args[t].SubS->tuples);
+    free_sub(Threads.Args[t].SubR);
+    free_sub(Threads.Args[t].SubS);
   }
+
+  free(Threads.RelR->histo); // (See relfile_open().)
+  free(Threads.RelS->histo);
+
+  textfile_cleanup();
 }
 
 
@@ -87,17 +173,6 @@ void create_rel_cleanup() {
 void *create_R(void* params) {
   thread_t   *T = (thread_t*)params;
 
-  /*
-   * If |S| is very large and skewed, create it first so that R is not deemed
-   * by the kernel as unused (and hence potentially swapped out).
-   * This ocassionally occurs (esp. on limited DRAM) since creating a large
-   * skewed relation takes much time.
-   */
-  if(Threads.RelS->size > 16U*128*1000*1000 && Threads.RelS->skew > 0.0) {
-    if(T->tid == 0) create_R_first = false; // Synchronized by pthread_join()
-    return NULL;
-  }
-
   /* Allocate, generate and NUMA-distribute relation R. */
   create_rel(T->tid, Threads.RelR, T->SubR);
 
@@ -111,125 +186,296 @@ void *create_R(void* params) {
 void *create_S(void* params) {
   thread_t   *T = (thread_t*)params;
 
-  /* Allocate, generate and NUMA-distribute relation R. */
+  /* Allocate, generate and NUMA-distribute relation S. */
   create_rel(T->tid, Threads.RelS, T->SubS);
 
-  /* See create_R for more information. */
-  if(!create_R_first) create_rel(T->tid, Threads.RelR, T->SubR);
+  return NULL;
+}
+
+
+/*
+ * Thread function to re-create relation S (e.g., from a new seed), freeing
+ * the thread's previous sub-relation of S.
+ */
+void *recreate_S(void* params) {
+  thread_t   *T = (thread_t*)params;
+
+  free_sub(T->SubS);
+  create_rel(T->tid, Threads.RelS, T->SubS);
+  rebase_sub(T->SubS); // Like the first S (e.g., if loaded again).
 
   return NULL;
 }
 
 
 /*
- * Seeds the global G structure.
+ * Prepares P as the permutation of [0, N) keyed by (seed, stream).
+ * The Feistel domain is the smallest even power of two covering N, i.e.,
+ * less than 4N; hence, cycle-walking (see permute()) takes fewer than four
+ * passes on average.
  */
-static void seed(uint32_t seed) {
-  G.w = 67819 + seed;  G.x = 2     + seed;
-  G.y = 138   + seed;  G.z = 9127  + seed;
+static void permutation_init(permutation_t *P, uint64_t N, uint64_t seed,
+                             uint64_t stream)
+{
+  uint64_t state = seed ^ splitmix64(&stream);
+
+  P->N         = N;
+  P->half_bits = MAX(1, (lg_ceil(MAX(N, 1)) + 1) / 2);
+  for(uint32_t r = 0; r < FeistelRounds; r++) P->Keys[r] = splitmix64(&state);
 }
 
 
 /*
- * Fills T with a random permutation of the numbers [1, N] inclusive.
+ * Returns the image of i (< P->N) under permutation P.
+ * A balanced Feistel network is a bijection over its (power of two) domain;
+ * re-applying it until the image falls within [0, N) ("cycle-walking")
+ * restricts it to a bijection over [0, N).
  */
-void permutation(tuple_t *T, uint32_t N) { if(N == 0) return;
-  for(uint32_t i = 0; i < N; i++) T[i].key = i+1;
+static inline uint64_t permute(permutation_t *P, uint64_t i) {
+  uint64_t mask = (1ULL << P->half_bits) - 1;
 
-  for(uint32_t i = N-1; i > 0; i--) {
-    uint32_t j = randgen(i, &G);
-    tkey_t tmp = T[i].key;
-    T[i].key   = T[j].key;
-    T[j].key   = tmp;
-  }
+  do {
+    uint64_t l = i >> P->half_bits, r = i & mask;
 
-  return;
+    for(uint32_t k = 0; k < FeistelRounds; k++) {
+      uint64_t f = r ^ P->Keys[k];
+      uint64_t t = l ^ (splitmix64(&f) & mask);
+      l = r;
+      r = t;
+    }
+
+    i = (l << P->half_bits) | r;
+  } while(i >= P->N);
+
+  return i;
 }
 
 
 /*
- * Fills the tuples in RelR with shuffled primary keys.
+ * Returns a hash of i, for the stream `stream` of seed `seed`.
  */
-void fill_primary_keys(relation_t* RelR) {
-  seed(RelR->seed);
-  permutation(RelR->tuples, RelR->size);
-  return;
+static inline uint64_t hash_at(uint64_t seed, uint64_t stream, uint64_t i) {
+  uint64_t state = seed ^ splitmix64(&stream) ^ (i * 0xD6E8FEB86659FD93ULL);
+  return splitmix64(&state);
 }
 
 
 /*
- * Fills the tuples in RelS with shuffled uniform foreign keys.
+ * Prepares O to map the positions of N tuples to ranks in [0, N).
  */
-void fill_foreign_keys(relation_t* RelR, relation_t* RelS) {
-  seed(RelS->seed);
+static void order_init(order_t *O, uint64_t N, uint64_t seed, uint64_t stream)
+{
+  O->N      = N;
+  O->seed   = seed ^ splitmix64(&stream);
+  O->window = UINT64_MAX;
+
+  if(Threads.Dist.order == 'r') permutation_init(&O->P, N, O->seed, 0);
+}
+
 
-  uint32_t ratio     = RelS->size / RelR->size;
-  for(uint32_t i = 0; i < ratio; i++) {
-    permutation(RelS->tuples + i*RelR->size, RelR->size);
+/*
+ * Returns the rank at position i (< O->N).
+ */
+static inline uint64_t order_rank(order_t *O, uint64_t i) {
+  switch(Threads.Dist.order) {
+    case 's': return i;
+    case 'r': return permute(&O->P, i);
   }
 
-  uint32_t remainder = RelS->size % RelR->size;
-  permutation(RelS->tuples + ratio*RelR->size, remainder);
+  /* Clustered: shuffle within own window (permuting it, if not yet). */
+  uint64_t c = Threads.Dist.cluster, first = i / c * c;
 
-  return;
+  if(O->window != i / c) {
+    O->window = i / c;
+    permutation_init(&O->P, MIN(c, O->N - first), O->seed, O->window);
+  }
+
+  return first + permute(&O->P, i - first);
 }
 
 
 /*
- * Fills the tuples in RelS with random foreign keys following a skewed
- * Zipfian distribution, with z = RelS->skew.
- * Based off algorithm used by Balkesen et al.
- * (http://www.systems.ethz.ch/projects/paralleljoins)
- * as implemented by Jens Teubner
- * (itself derived from code originally written by Rene Mueller).
+ * Returns the key of rank j of R, or (if !match) a key absent from R.
  */
-void fill_skewed_keys(relation_t* RelR, relation_t* RelS) {
-  seed(RelS->seed);
-  srand(RelS->seed);
+static inline tkey_t key_of(uint64_t j, bool match) {
+  uint64_t d = Threads.Dist.sparsity, seed = Threads.RelR->seed;
+  uint64_t o = (d > 1) ? hash_at(seed, 1, j) % d : 0;
 
-  double d = 0, s = 0;
-  double z = RelS->skew;
+  if(match)  return j * d + 1 + o;
+  if(d == 1) return Threads.RelR->size + 1 + j;
 
-  /* Produce a random permutation of all keys. */
-  uint32_t *Keys = SafeMalloc(RelR->size * sizeof(uint32_t));
-  for(uint32_t i = 0; i < RelR->size; i++) Keys[i] = i+1;
-  for(uint32_t i = RelR->size-1; i > 0; i--) {
-    uint32_t j = randgen(i, &G);
-    /* uint32_t j = (uint64_t) i * rand() / RAND_MAX; */
+  return j * d + 1 + (o + 1 + hash_at(seed, 2, j) % (d - 1)) % d;
+}
 
-    tkey_t tmp = Keys[i];
-    Keys[i]    = Keys[j];
-    Keys[j]    = tmp;
-  }
 
-  /* Produce a lookup table. */
-  double *Table = SafeMalloc(RelR->size * sizeof(double));
-  for(uint32_t i = 0; i < RelR->size; i++) d += 1.0 / pow(i+1, z);
-  for(uint32_t i = 0; i < RelR->size; i++) {
-    s += 1.0 / pow(i+1, z);
-    Table[i] = s / d;
+/*
+ * Returns the key of a tuple of S at position i referencing rank j of R.
+ */
+static inline tkey_t foreign_key_of(relation_t *RelS, uint64_t i, uint64_t j) {
+  double m     = Threads.Dist.match_rate;
+  bool   match = (m >= 1) || hash_at(RelS->seed, 3, i) < ldexp(m, 64);
+
+  return key_of(j, match);
+}
+
+
+/*
+ * Returns the tuple with key k at position i (of its relation).
+ */
+static inline tuple_t tuple_of(tkey_t k, uint64_t i) {
+  return make_tuple(k, Threads.Dist.correlated ? k : i + 1);
+}
+
+
+/*
+ * Returns the largest key of generated relations, i.e., of R's keys' domain
+ * and of S's keys absent from R.
+ */
+uint64_t generated_max_key() {
+  uint64_t size = Threads.RelR->size;
+
+  if(Threads.Dist.sparsity > 1)   return Threads.Dist.sparsity * size;
+  if(Threads.Dist.match_rate < 1) return 2 * size;
+  return size;
+}
+
+
+/*
+ * Fills Sub, of RelR, with primary keys.
+ */
+void fill_primary_keys(relation_t* RelR, relation_t *Sub) {
+  order_t O;
+  order_init(&O, RelR->size, RelR->seed, 0);
+
+  for(uint32_t i = 0; i < Sub->size; i++) {
+    uint64_t at = (uint64_t)Sub->offset + i;
+    tuple_set(Sub, i, tuple_of(key_of(order_rank(&O, at), true), at));
   }
 
-  /* Fill Relation S. */
-  for(uint32_t i = 0; i < RelS->size; i++) {
-    uint32_t l = 0, r = RelR->size - 1;
+  return;
+}
+
+
+/*
+ * Fills Sub, of RelS, with uniform foreign keys: RelS consists of
+ * consecutive orderings of RelR's ranks (the last one possibly of
+ * [0, |S| % |R|) only), each keyed by its own stream.
+ */
+void fill_foreign_keys(relation_t* RelR, relation_t* RelS, relation_t *Sub) {
+  uint64_t i = Sub->offset, to = (uint64_t)Sub->offset + Sub->size;
 
-    double x = ((double) rand()) / RAND_MAX;
-    /* double x = ((double) randgen(INT_MAX, &G)) / UINT_MAX; */
+  while(i < to) {
+    uint64_t copy  = i / RelR->size, first = copy * RelR->size;
+    uint64_t end   = MIN((uint64_t)RelS->size, first + RelR->size);
 
-    if(Table[0] >= x) r = 0;
+    order_t O;
+    order_init(&O, end - first, RelS->seed, copy);
 
-    while(r - l > 1) { uint32_t m = l + (r - l) / 2;
-      if (Table[m] < x) l = m; else r = m;
+    for(; i < MIN(end, to); i++) {
+      uint64_t rank = order_rank(&O, i - first);
+      tuple_set(Sub, i - Sub->offset,
+                tuple_of(foreign_key_of(RelS, i, rank), i));
     }
+  }
+
+  return;
+}
+
+
+/*
+ * Returns a uniform random double in [0, 1), of 53 random bits.
+ */
+static inline double uniform(randgen_t *G) {
+  uint64_t hi = xorshift128(G) >> 5, lo = xorshift128(G) >> 6; // 27 + 26 bits.
+  return (hi * 67108864.0 + lo) / 9007199254740992.0;
+}
+
+
+/*
+ * Zipf Sampler by Rejection-Inversion:
+ *   W. Hormann and G. Derflinger, "Rejection-inversion to generate variates
+ *   from monotone discrete distributions", ACM TOMACS 6(3), 1996.
+ * Samples rank k in [1, N] with probability proportional to 1 / k^z, in O(1)
+ * expected time and space, by inverting H, an integral of h(x) = 1 / x^z,
+ * and rejecting the (few) draws that fall outside the histogram of h.
+ */
+static inline double zipf_helper1(double x) { // log(1 + x) / x
+  return (fabs(x) > 1e-8) ? log1p(x) / x : 1 - x * (0.5 - x / 3);
+}
+
+static inline double zipf_helper2(double x) { // (exp(x) - 1) / x
+  return (fabs(x) > 1e-8) ? expm1(x) / x : 1 + x * 0.5 * (1 + x / 3);
+}
+
+static inline double zipf_h(zipf_t *Z, double x) {
+  return exp(-Z->z * log(x));
+}
+
+static inline double zipf_H(zipf_t *Z, double x) {
+  double log_x = log(x);
+  return zipf_helper2((1 - Z->z) * log_x) * log_x;
+}
+
+static inline double zipf_H_inverse(zipf_t *Z, double x) {
+  double t = MAX(x * (1 - Z->z), -1.0);
+  return exp(zipf_helper1(t) * x);
+}
+
 
-    RelS->tuples[i].key = Keys[r];
+static void zipf_init(zipf_t *Z, uint64_t N, double z) {
+  assert(N >= 1 && z > 0);
+
+  Z->N  = N;
+  Z->z  = z;
+  Z->H1 = zipf_H(Z, 1.5) - 1;
+  Z->HN = zipf_H(Z, N + 0.5);
+  Z->s  = 2 - zipf_H_inverse(Z, zipf_H(Z, 2.5) - zipf_h(Z, 2));
+}
+
+
+static inline uint64_t zipf_sample(zipf_t *Z, randgen_t *G) {
+  while(true) {
+    double   u = Z->HN + uniform(G) * (Z->H1 - Z->HN);
+    double   x = zipf_H_inverse(Z, u);
+    uint64_t k = (x < 1.5) ? 1 : MIN((uint64_t)(x + 0.5), Z->N);
+
+    if(k - x <= Z->s || u >= zipf_H(Z, k + 0.5) - zipf_h(Z, k)) return k;
   }
+}
 
 
-  /* Cleanup. */
-  free(Keys);
-  free(Table);
+/*
+ * Fills Sub, of RelS, with random foreign keys following a skewed Zipfian
+ * distribution, with z = RelS->skew: Zipf ranks are sampled by rejection-
+ * inversion (see zipf_sample()), then mapped to R's ranks (hence, keys) by a
+ * random permutation (as in the algorithm used by Balkesen et al.,
+ * http://www.systems.ethz.ch/projects/paralleljoins).
+ * Tuple i is drawn from stream i / GenBlock; hence, a thread starting
+ * mid-block first skips the block's earlier draws.
+ */
+void fill_skewed_keys(relation_t* RelR, relation_t* RelS, relation_t *Sub) {
+  zipf_t        Z;
+  permutation_t Keys; // Zipf rank to R's rank.
+
+  zipf_init(&Z, RelR->size, RelS->skew);
+  permutation_init(&Keys, RelR->size, RelS->seed, UINT64_MAX);
+
+  uint64_t from = Sub->offset, to = (uint64_t)Sub->offset + Sub->size;
+
+  for(uint64_t block = from / GenBlock; block * GenBlock < to; block++) {
+    randgen_t Gen;
+    randgen_seed(&Gen, RelS->seed, block);
+
+    uint64_t end = MIN(to, (block + 1) * GenBlock);
+    for(uint64_t i = block * GenBlock; i < end; i++) {
+      uint64_t rank = zipf_sample(&Z, &Gen);
+
+      if(i >= from) {
+        uint64_t j = permute(&Keys, rank - 1);
+        tuple_set(Sub, i - from, tuple_of(foreign_key_of(RelS, i, j), i));
+      }
+    }
+  }
 
   return;
 }
@@ -0,0 +1,260 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Huge-page Backed Allocation, with Pre-faulting.
+ *
+ * (a) HugeAlloc(size, node) maps memory placed on `node` (or interleaved, if
+ *     AllNodes; see util/numa.c), in order of preference:
+ *       # from hugetlbfs pages (MAP_HUGETLB), while enough are free;
+ *       # from anonymous memory aligned to, and advised as, transparent huge
+ *         pages (madvise(MADV_HUGEPAGE)), unless THP is disabled.
+ *     Without --hugepages (and --prefault), it simply defers to NodeAlloc()
+ *     or InterleavedAlloc(), registering the memory for HugeFree().
+ *
+ * (b) huge_reserve(size, node) maps and pre-faults such memory ahead of time
+ *     (i.e., before the clock starts). A later HugeAlloc() of the same size
+ *     and node takes it over, instead of faulting its pages within a timed
+ *     phase. Pages are pre-faulted by MAP_POPULATE where no NUMA placement is
+ *     needed, and by touching them after placement otherwise.
+ *
+ * (c) huge_pages_report() prints how many huge pages were actually obtained;
+ *     for THP, as counted by the kernel in /proc/self/smaps.
+ *
+ * Memory from HugeAlloc() must be released by HugeFree() (not free()).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "common.h"
+
+/* Mapped Region. */
+typedef struct {
+  char    *p;
+  size_t   size;     // Mapped bytes (a multiple of SysInfo.page_size).
+  uint32_t node;
+  bool     hugetlb;  // Backed by hugetlbfs pages (else, by THP or base pages).
+  bool     reserved; // Pre-faulted by huge_reserve(), but not yet handed out.
+  bool     plain;    // From NodeAlloc(), of `size` bytes (not huge pages).
+} region_t;
+
+/* Global Variables. */
+static region_t       *Regions;
+static uint32_t        num_regions, max_regions;
+static pthread_mutex_t RegionsLock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t        HugetlbUsed;       // hugetlbfs pages mapped so far.
+static uint64_t        FreedHuge, FreedAll; // (Huge) pages of freed regions.
+
+
+/*
+ * Returns the number of huge pages backing [p, p + size), as counted by the
+ * kernel per mapping in /proc/self/smaps (bounded by size, as adjacent
+ * mappings may have been merged with the region).
+ */
+static uint64_t thp_pages(char *p, size_t size) {
+  char buffer[LINEMAX];
+  uint64_t from = 0, to = 0, kbytes, total = 0;
+  FILE* file = fopen("/proc/self/smaps", "r");
+  if(!file) return 0;
+
+  while(fgets(buffer, LINEMAX, file)) {
+    uint64_t a, b;
+    if(sscanf(buffer, "%lx-%lx ", &a, &b) == 2) { from = a; to = b; continue; }
+
+    bool overlaps = (from < (uint64_t)(p + size) && to > (uint64_t)p);
+    if(overlaps && sscanf(buffer, "AnonHugePages: %lu kB", &kbytes) == 1) {
+      total += kbytes * 1024;
+    }
+  }
+
+  fclose(file);
+
+  return MIN(total, size) / SysInfo.page_size;
+}
+
+
+/*
+ * Returns the number of huge pages backing region R.
+ */
+static uint64_t region_huge_pages(region_t *R) {
+  return R->hugetlb ? R->size / SysInfo.page_size : thp_pages(R->p, R->size);
+}
+
+
+/*
+ * Registers region R.
+ */
+static void add_region(region_t R) {
+  pthread_mutex_lock(&RegionsLock);
+  if(num_regions == max_regions) {
+    max_regions = MAX(2 * max_regions, 16);
+    Regions     = realloc(Regions, max_regions * sizeof(region_t));
+    assert(Regions != NULL);
+  }
+
+  Regions[num_regions++] = R;
+  pthread_mutex_unlock(&RegionsLock);
+}
+
+
+/*
+ * Maps `size` bytes (rounded up to huge pages) on `node`, pre-faulted if
+ * `prefault`, and registers it as a region. Returns the region's start.
+ */
+static char *map_region(size_t size, uint32_t node, bool prefault) {
+  size_t huge     = SysInfo.page_size;
+  size_t len      = (MAX(size, 1) + huge - 1) / huge * huge;
+  bool   populate = prefault && SysInfo.num_nodes <= 1; // No placement needed.
+  bool   hugetlb  = false;
+  char  *p        = MAP_FAILED;
+
+  /* (1) hugetlbfs pages, while enough are free. */
+  pthread_mutex_lock(&RegionsLock);
+  if(Threads.huge_pages && HugetlbUsed + len / huge <= SysInfo.hugetlb_pages) {
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+             (populate ? MAP_POPULATE : 0), -1, 0);
+
+    if((hugetlb = (p != MAP_FAILED))) HugetlbUsed += len / huge;
+  }
+  pthread_mutex_unlock(&RegionsLock);
+
+  /* (2) Otherwise, anonymous memory, aligned to (transparent) huge pages. */
+  if(!hugetlb) {
+    char *q = mmap(NULL, len + huge, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    assert(q != MAP_FAILED);
+
+    p = (char*)(((uintptr_t)q + huge - 1) & ~(uintptr_t)(huge - 1));
+    if(p > q)            munmap(q, p - q);                 // Head.
+    if(p < q + huge)     munmap(p + len, q + huge - p);    // Tail.
+
+    if(Threads.huge_pages && SysInfo.thp != 'n') {
+      madvise(p, len, MADV_HUGEPAGE);
+    }
+
+    populate = false; // MAP_POPULATE would fault pages before madvise().
+  }
+
+  numa_place(p, len, node);
+
+  /* Pre-fault, touching one byte per base page, after placement. */
+  if(prefault && !populate) {
+    for(size_t i = 0; i < len; i += SysInfo.base_page_size) {
+      ((volatile char*)p)[i] = 0;
+    }
+  }
+
+  add_region((region_t){p, len, node, hugetlb, prefault, false});
+  return p;
+}
+
+
+
+/*
+ * Allocates `size` bytes on `node` (or interleaved, if AllNodes), backed by
+ * huge pages if --hugepages, taking over a reserved region if one fits.
+ */
+void* HugeAlloc(size_t size, uint32_t node) {
+  size_t huge = SysInfo.page_size;
+  size_t len  = (MAX(size, 1) + huge - 1) / huge * huge;
+
+  /* Take over a pre-faulted region of the same size and node, if any. */
+  pthread_mutex_lock(&RegionsLock);
+  for(uint32_t i = 0; i < num_regions; i++) {
+    region_t *R = Regions + i;
+
+    if(R->reserved && R->size == len && R->node == node) {
+      R->reserved = false;
+      pthread_mutex_unlock(&RegionsLock);
+      return R->p;
+    }
+  }
+  pthread_mutex_unlock(&RegionsLock);
+
+  if(!Threads.huge_pages && !Threads.prefault) {
+    char *p = (node == AllNodes) ? InterleavedAlloc(size)
+                                 : NodeAlloc(size, node);
+    add_region((region_t){p, size, node, false, false, true});
+    return p;
+  }
+
+  return map_region(size, node, false);
+}
+
+
+/*
+ * Frees memory allocated by HugeAlloc().
+ */
+void HugeFree(void *p) {
+  if(p == NULL) return;
+
+  pthread_mutex_lock(&RegionsLock);
+  for(uint32_t i = 0; i < num_regions; i++) {
+    region_t R = Regions[i];
+    if(R.p != p) continue;
+
+    Regions[i] = Regions[--num_regions];
+    if(R.plain) {
+      pthread_mutex_unlock(&RegionsLock);
+      NodeFree(R.p, R.size);
+      return;
+    }
+
+    FreedHuge += region_huge_pages(&R);
+    FreedAll  += R.size / SysInfo.page_size;
+    if(R.hugetlb) HugetlbUsed -= R.size / SysInfo.page_size;
+    pthread_mutex_unlock(&RegionsLock);
+
+    munmap(R.p, R.size);
+    return;
+  }
+  pthread_mutex_unlock(&RegionsLock);
+
+  assert(false); // Not from HugeAlloc().
+}
+
+
+/*
+ * Maps and pre-faults `size` bytes on `node`, for a later HugeAlloc().
+ */
+void huge_reserve(size_t size, uint32_t node) {
+  map_region(size, node, true);
+}
+
+
+
+/*
+ * Prints how many of the (huge-page-sized) pages mapped so far, including
+ * by freed regions, are actually backed by huge pages.
+ */
+void huge_pages_report() {
+  uint64_t huge = FreedHuge, all = FreedAll, hugetlb = 0;
+
+  pthread_mutex_lock(&RegionsLock);
+  for(uint32_t i = 0; i < num_regions; i++) {
+    if(Regions[i].plain) continue;
+    huge    += region_huge_pages(Regions + i);
+    all     += Regions[i].size / SysInfo.page_size;
+    hugetlb += Regions[i].hugetlb ? Regions[i].size / SysInfo.page_size : 0;
+  }
+  pthread_mutex_unlock(&RegionsLock);
+
+  printf("Huge Pages: %lu of %lu (%lu KiBs each) obtained; "
+         "%lu live from hugetlbfs, THP mode '%c'.\n",
+         huge, all, SysInfo.page_size / 1024, hugetlb, SysInfo.thp);
+}
+
+
+/*
+ * Frees remaining (e.g., reserved but unused) regions.
+ */
+void huge_pages_cleanup() {
+  while(num_regions > 0) HugeFree(Regions[num_regions - 1].p);
+
+  free(Regions);
+  Regions     = NULL;
+  max_regions = 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * NUMA-aware Allocation.
+ *
+ * Places memory deterministically on NUMA nodes (see SysInfo.num_nodes and
+ * cpu_t.node), instead of relying on which thread first touches it:
+ *   (a) NodeAlloc(size, node): page-aligned memory preferring one node.
+ *   (b) InterleavedAlloc(size): pages interleaved across the nodes of all
+ *       of Threads.Args' CPUs, e.g., for a table shared by all threads.
+ *   (c) numa_bind_thread(node): makes the calling thread's allocations
+ *       prefer a node (used by the worker pool, per thread's CPU).
+ *   (d) numa_place(p, size, node): applies (a), or (b) if node is AllNodes,
+ *       to already mapped (yet untouched) memory.
+ *
+ * Policies are set by the raw mbind() and set_mempolicy() system calls; no
+ * libnuma is required. On a single node, or if the kernel refuses a policy,
+ * placement falls back to first-touch (as before). Memory from (a) and (b)
+ * is mapped apart from the heap (so that moving its pages cannot move other
+ * data's), and is released by NodeFree(p, size), not free().
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "common.h"
+
+/* Node Masks, as expected by the kernel. */
+#define MaxNodes   1024
+#define MaskWords  (MaxNodes / (8 * sizeof(unsigned long)))
+typedef struct { unsigned long bits[MaskWords]; } nodemask_t;
+
+/* Global Variables. */
+static bool PolicyFailed = false; // Warn once, then rely on first-touch.
+
+
+static inline void nodemask_set(nodemask_t *Mask, uint32_t node) {
+  assert(node < MaxNodes);
+  Mask->bits[node / (8 * sizeof(unsigned long))] |=
+    1UL << (node % (8 * sizeof(unsigned long)));
+}
+
+
+/*
+ * Reports a failed policy once; placement falls back to first-touch.
+ */
+static void policy_failed(char *call) {
+  if(__sync_bool_compare_and_swap(&PolicyFailed, false, true)) {
+    printf("Warning: %s() failed; relying on first-touch NUMA placement.\n",
+           call);
+  }
+}
+
+
+/*
+ * Returns `size` rounded up to whole base pages (at least one).
+ */
+static size_t page_round(size_t size) {
+  size_t page = SysInfo.base_page_size;
+  return (MAX(size, 1) + page - 1) / page * page;
+}
+
+
+/*
+ * Places the pages of [p, p + size) (p page-aligned) on node `node`, or
+ * interleaved across the nodes of utilized CPUs if `node` is AllNodes.
+ */
+void numa_place(void *p, size_t size, uint32_t node) {
+  if(SysInfo.num_nodes <= 1 || PolicyFailed) return;
+
+  nodemask_t Mask = {{0}};
+  int        mode = MPOL_PREFERRED;
+
+  if(node != AllNodes) nodemask_set(&Mask, node);
+  else {
+    mode = MPOL_INTERLEAVE;
+    for(uint32_t t = 0; t < Threads.N; t++) {
+      nodemask_set(&Mask, Threads.Args[t].CPU->node);
+    }
+  }
+
+  if(syscall(SYS_mbind, p, page_round(size), mode, Mask.bits, MaxNodes + 1,
+             MPOL_MF_MOVE) != 0)
+  {
+    policy_failed("mbind");
+  }
+}
+
+
+
+/*
+ * Allocates `size` bytes, preferably placed on NUMA node `node`.
+ */
+void* NodeAlloc(size_t size, uint32_t node) {
+  void *p = mmap(NULL, page_round(size), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(p != MAP_FAILED);
+
+  numa_place(p, size, node);
+  return p;
+}
+
+
+/*
+ * Allocates `size` bytes, interleaved across the nodes of utilized CPUs.
+ */
+void* InterleavedAlloc(size_t size) {
+  return NodeAlloc(size, AllNodes);
+}
+
+
+/*
+ * Frees `size` bytes from NodeAlloc() or InterleavedAlloc().
+ */
+void NodeFree(void *p, size_t size) {
+  if(p != NULL) munmap(p, page_round(size));
+}
+
+
+/*
+ * Makes the calling thread's future allocations prefer NUMA node `node`.
+ */
+void numa_bind_thread(uint32_t node) {
+  if(SysInfo.num_nodes <= 1 || PolicyFailed) return;
+
+  nodemask_t Mask = {{0}};
+  nodemask_set(&Mask, node);
+
+  if(syscall(SYS_set_mempolicy, MPOL_PREFERRED, Mask.bits, MaxNodes + 1) != 0) {
+    policy_failed("set_mempolicy");
+  }
+}
@@ -0,0 +1,93 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Relation Cache.
+ *
+ * With --cache[=dir] (by default, /dev/shm), generated relations are saved
+ * as binary relation files (see relfile.c) named after a hash of everything
+ * that determines their content: the generator's version, the relation, its
+ * size, seed and skew, the workload parameters (Threads.Dist), the layout
+ * (rows or columns, so the copy is mapped as is), and, for S, the size and
+ * seed of R (which determine R's keys).
+ *
+ * (a) relcache_prepare(Rel), before a relation is created, points Rel->path
+ *     to its cached copy if one exists, so it is mapped instead of generated
+ *     (and thus identical, byte for byte, to the first run's input).
+ * (b) relcache_store(Rel), after a relation was generated, saves it to the
+ *     cache, via a temporary file renamed into place, so concurrent runs
+ *     never map a partial file. A failure to store is reported, not fatal.
+ *
+ * Relations loaded by the user (--load_r, --load_s) are not cached.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+
+/* Constants. */
+#define GeneratorVersion 2 // Bump whenever generated relations change.
+
+/* Global Variables. */
+static char Paths[2][LINEMAX]; // Cached copies of relations R and S.
+
+
+/*
+ * Returns the hash of the parameters that determine Rel's content.
+ */
+static uint64_t relcache_key(relation_t *Rel) {
+  dist_t  *D = &Threads.Dist;
+  uint64_t skew, match;
+  memcpy(&skew,  &Rel->skew,     sizeof(skew));
+  memcpy(&match, &D->match_rate, sizeof(match));
+
+  uint64_t Params[] = {GeneratorVersion, Rel->id, Rel->size, Rel->seed,
+                       (Rel->id == 'S') ? skew : 0,
+                       (Rel->id == 'S') ? Threads.RelR->size : 0,
+                       (Rel->id == 'S') ? Threads.RelR->seed : 0,
+                       sizeof(tuple_t), D->sparsity,
+                       (Rel->id == 'S') ? match : 0,
+                       D->order, (D->order == 'c') ? D->cluster : 0,
+                       D->correlated, Threads.columnar};
+
+  uint64_t key = 0;
+  for(uint32_t i = 0; i < sizeof(Params) / sizeof(uint64_t); i++) {
+    uint64_t state = key ^ Params[i];
+    key = splitmix64(&state);
+  }
+
+  return key;
+}
+
+
+
+/*
+ * Points Rel->path to Rel's cached copy if it exists, or to none otherwise.
+ */
+void relcache_prepare(relation_t *Rel) {
+  if(Threads.cache_dir == NULL || (Rel->path && !Rel->cached)) return;
+
+  char *path = Paths[Rel->id == 'S'];
+  snprintf(path, LINEMAX, "%s/polyHJ-%c-%u-%016lx.rel", Threads.cache_dir,
+           Rel->id, Rel->size, relcache_key(Rel));
+
+  Rel->cached = (access(path, R_OK) == 0);
+  Rel->path   = Rel->cached ? path : NULL;
+}
+
+
+/*
+ * Saves the (just generated) relation Rel to the cache.
+ */
+void relcache_store(relation_t *Rel) {
+  if(Threads.cache_dir == NULL || Rel->path) return;
+
+  char *path = Paths[Rel->id == 'S'], temp[LINEMAX + 32];
+  snprintf(temp, sizeof(temp), "%s.%d.tmp", path, getpid());
+
+  if(!relfile_write(Rel, temp) || rename(temp, path) != 0) {
+    printf("Warning: Unable to cache relation %c in ``%s``.\n", Rel->id, path);
+    unlink(temp);
+  }
+}
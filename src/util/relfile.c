@@ -0,0 +1,407 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Binary Relation Files.
+ *
+ * (a) Format: one header page, then the tuples, as follows:
+ *       # relfile_header_t (see below), little-endian;
+ *       # if RelFileHisto, a histogram of the keys' lowest `histo_bits` bits
+ *         (i.e., of the keys' radix partitions): 2^histo_bits uint64_t counts;
+ *       # from `data_offset` (page-aligned), the data, either as
+ *           - RelFileRows:    `count` tuples, each a key then a payload; or
+ *           - RelFileColumns: `count` keys, then (from `payload_offset`,
+ *                             page-aligned) `count` payloads.
+ *     If RelFileMinMax, `min_key` and `max_key` must bound the keys: keys
+ *     are rebased to [0, max_key - min_key] (see main.c), tables are sized
+ *     by that range (and builds assert it), and it must be below 2^32 - 1
+ *     (checked by relfile_open()).
+ *     The largest payload (e.g., 2^32 - 1) is reserved (see ColBP_I()); as
+ *     rows are mapped rather than parsed, it is not checked, and joining a
+ *     file that holds it is undefined (its tuples may not match).
+ *
+ * (b) relfile_open(Rel) validates Rel->path and sets Rel->size, before the
+ *     relation is split into sub-relations, and reads the histogram, if any,
+ *     into Rel->histo (e.g., for the planner's partition sizes of S; see
+ *     plan_sample()).
+ *
+ * (c) relfile_map(tid, Rel, Sub) maps the sub-relation's slice of the file,
+ *     by the thread that owns it. Rows are mapped directly (privately, as ICP
+ *     partitions sub-relations in place; the file itself is never written),
+ *     so there is no parse or copy step: pages are read on demand, ahead of
+ *     time (MADV_WILLNEED) and sequentially (MADV_SEQUENTIAL), and copied on
+ *     their first write. With --prefault, they are read and copied on the
+ *     thread's NUMA node at load time instead, outside the timed join (as
+ *     are cached relations; see relcache.c).
+ *     Likewise, columns are mapped directly under --columnar. Otherwise, a
+ *     layout other than the relation's is converted into (NUMA-local) tuples
+ *     or columns.
+ *
+ * (d) relfile_write(Rel, path) saves a (generated) relation in its layout.
+ *
+ * Key and payload widths must match this build's (see TUPLE_WIDTH in types.h).
+ *
+ * Files not starting with the format's magic are loaded as text instead
+ * (see textfile.c).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "common.h"
+
+/* Constants. */
+#define RelFileMagic     "PolyHJR\n"
+#define RelFileVersion   1
+#define RelFileAlign     4096
+#define RelFileHistoBits 10
+
+/* Flags and Layouts. */
+enum { RelFileMinMax = 1, RelFileHisto = 2 };
+enum { RelFileRows = 0, RelFileColumns = 1 };
+
+/* Header. */
+typedef struct {
+  char     magic[8];
+  uint32_t version;
+  uint32_t layout;         // RelFileRows or RelFileColumns.
+  uint64_t count;          // Number of tuples.
+  uint32_t key_bytes;
+  uint32_t payload_bytes;
+  uint32_t flags;          // RelFileMinMax | RelFileHisto.
+  uint32_t histo_bits;
+  uint64_t min_key, max_key;
+  uint64_t data_offset;    // Of tuples (rows), or of keys (columns).
+  uint64_t payload_offset; // Of payloads (columns only).
+} relfile_header_t;
+
+
+/*
+ * Reports an unusable relation file and exits.
+ */
+static void relfile_error(char *path, char *reason) {
+  printf(">> Cannot load relation file ``%s``: %s.\n", path, reason);
+  exit(1);
+}
+
+
+/*
+ * Returns whether Rel->path is a text (rather than a binary) relation file.
+ */
+static bool is_text(relation_t *Rel) {
+  char magic[8] = {0};
+  int  fd = open(Rel->path, O_RDONLY);
+  if(fd < 0) relfile_error(Rel->path, "unable to open");
+
+  bool text = (pread(fd, magic, 8, 0) != 8 || memcmp(magic, RelFileMagic, 8));
+  close(fd);
+
+  return text;
+}
+
+
+/*
+ * Opens Rel->path and reads (and validates) its header into H.
+ * Returns the file descriptor.
+ */
+static int read_header(relation_t *Rel, relfile_header_t *H) {
+  int fd = open(Rel->path, O_RDONLY);
+  if(fd < 0) relfile_error(Rel->path, "unable to open");
+
+  if(pread(fd, H, sizeof(*H), 0) != sizeof(*H)) {
+    relfile_error(Rel->path, "truncated header");
+  }
+
+  if(memcmp(H->magic, RelFileMagic, 8) || H->version != RelFileVersion) {
+    relfile_error(Rel->path, "not a PolyHJ relation file (version 1)");
+  }
+
+  if(H->key_bytes != KEY_BYTES || H->payload_bytes != PAYLOAD_BYTES) {
+    relfile_error(Rel->path, "key/payload widths differ from this build's "
+                             "(see --width)");
+  }
+
+  if(H->count > UINT32_MAX) relfile_error(Rel->path, "too many tuples");
+
+  if(H->layout != RelFileRows && H->layout != RelFileColumns) {
+    relfile_error(Rel->path, "unknown layout");
+  }
+
+  if((H->flags & RelFileMinMax) &&
+     (H->min_key > H->max_key || H->max_key - H->min_key >= UINT32_MAX))
+  {
+    relfile_error(Rel->path, "key range (max_key - min_key) not below "
+                             "2^32 - 1");
+  }
+
+  if(PAYLOAD_BYTES == 0) H->layout = RelFileRows; // Key-only: both are keys.
+
+  return fd;
+}
+
+
+/*
+ * Maps [offset, offset + size) of file fd, privately.
+ * Returns the (unaligned) start of the range; *base and *len are set to the
+ * whole mapping.
+ */
+static char *map_range(int fd, uint64_t offset, size_t size, bool populate,
+                       void **base, size_t *len)
+{
+  uint64_t aligned = offset / SysInfo.base_page_size * SysInfo.base_page_size;
+
+  *len  = offset - aligned + size;
+  *base = mmap(NULL, *len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, aligned);
+  assert(*base != MAP_FAILED);
+
+  madvise(*base, *len, MADV_SEQUENTIAL);
+  madvise(*base, *len, MADV_WILLNEED);
+
+  return (char*)*base + (offset - aligned);
+}
+
+
+
+/*
+ * Sets Rel->size from the header of Rel->path.
+ */
+void relfile_open(relation_t *Rel) {
+  if(is_text(Rel)) { textfile_open(Rel); return; }
+
+  relfile_header_t H;
+  int fd = read_header(Rel, &H);
+
+  /* The file must hold all its data. */
+  uint64_t end = (H.layout == RelFileRows)
+               ? H.data_offset + H.count * sizeof(tuple_t)
+               : H.payload_offset + H.count * sizeof(tpayload_t);
+  if((uint64_t)lseek(fd, 0, SEEK_END) < end) {
+    relfile_error(Rel->path, "truncated data");
+  }
+
+  /* Histogram, if any (and if it lies before the data). */
+  uint64_t num_counts = 1ULL << MIN(H.histo_bits, 32);
+  if((H.flags & RelFileHisto) && H.histo_bits <= RelFileHistoBits &&
+     sizeof(H) + num_counts * sizeof(uint64_t) <= H.data_offset)
+  {
+    Rel->histo      = SafeMalloc(num_counts * sizeof(uint64_t));
+    Rel->histo_bits = H.histo_bits;
+
+    if(pread(fd, Rel->histo, num_counts * sizeof(uint64_t), sizeof(H))
+       != (ssize_t)(num_counts * sizeof(uint64_t)))
+    {
+      relfile_error(Rel->path, "truncated histogram");
+    }
+  }
+
+  close(fd);
+
+  Rel->size = H.count;
+}
+
+
+/*
+ * Maps (or, for columns or text, loads) Sub, of Rel, from Rel->path, for
+ * thread tid.
+ */
+void relfile_map(uint32_t tid, relation_t *Rel, relation_t *Sub) {
+  if(is_text(Rel)) { textfile_load(tid, Rel, Sub); return; }
+
+  relfile_header_t H;
+  int fd = read_header(Rel, &H);
+
+  Sub->mapping = Sub->payload_mapping = NULL;
+  Sub->mapping_size = Sub->payload_mapping_size = 0;
+  Sub->tuples = NULL; Sub->keys = NULL; Sub->payloads = NULL;
+  Sub->max_key = 0;
+
+  if(Sub->size == 0) { close(fd); return; }
+
+  bool     populate = Threads.prefault || Rel->cached;
+  uint64_t from     = Sub->offset;
+  size_t   count    = Sub->size;
+
+  /* Same layout: map the slice (of rows, or of each column) itself. */
+  if(H.layout == RelFileRows && !Threads.columnar) {
+    Sub->tuples = (tuple_t*)map_range(fd,
+                    H.data_offset + from * sizeof(tuple_t),
+                    count * sizeof(tuple_t), populate,
+                    &Sub->mapping, &Sub->mapping_size);
+  }
+  else if(H.layout == RelFileColumns && Threads.columnar) {
+    Sub->keys     = (tkey_t*)map_range(fd,
+                      H.data_offset + from * sizeof(tkey_t),
+                      count * sizeof(tkey_t), populate,
+                      &Sub->mapping, &Sub->mapping_size);
+    Sub->payloads = (tpayload_t*)map_range(fd,
+                      H.payload_offset + from * sizeof(tpayload_t),
+                      count * sizeof(tpayload_t), populate,
+                      &Sub->payload_mapping, &Sub->payload_mapping_size);
+  }
+
+  /* Other layout: convert the slice into (NUMA-local) tuples or columns. */
+  else {
+    void  *base;
+    size_t len;
+
+    sub_alloc(tid, Sub);
+
+    if(H.layout == RelFileRows) {
+      tuple_t *Rows = (tuple_t*)map_range(fd,
+                        H.data_offset + from * sizeof(tuple_t),
+                        count * sizeof(tuple_t), false, &base, &len);
+
+      for(uint32_t i = 0; i < Sub->size; i++) tuple_set(Sub, i, Rows[i]);
+      munmap(base, len);
+    }
+    else {
+      void  *pbase;
+      size_t plen;
+
+      tkey_t     *Keys     = (tkey_t*)map_range(fd,
+                               H.data_offset + from * sizeof(tkey_t),
+                               count * sizeof(tkey_t), false, &base, &len);
+      tpayload_t *Payloads = (tpayload_t*)map_range(fd,
+                               H.payload_offset + from * sizeof(tpayload_t),
+                               count * sizeof(tpayload_t), false,
+                               &pbase, &plen);
+
+      for(uint32_t i = 0; i < Sub->size; i++) {
+        Sub->tuples[i] = make_tuple(Keys[i], Payloads[i]);
+      }
+
+      munmap(base, len);
+      munmap(pbase, plen);
+    }
+  }
+
+  close(fd);
+
+  /* Key bounds: those of the generator, of the header, or found. */
+  if(Rel->cached) {
+    Sub->min_key = 0;
+    Sub->max_key = generated_max_key();
+  }
+  else if(H.flags & RelFileMinMax) {
+    Sub->min_key = H.min_key;
+    Sub->max_key = H.max_key;
+  }
+  else {
+    Sub->min_key = UINT64_MAX;
+    Sub->max_key = 0;
+    for(uint32_t i = 0; i < Sub->size; i++) {
+      Sub->min_key = MIN(Sub->min_key, key_at(Sub, i));
+      Sub->max_key = MAX(Sub->max_key, key_at(Sub, i));
+    }
+  }
+}
+
+
+/*
+ * Unmaps Sub, as mapped by relfile_map().
+ */
+void relfile_unmap(relation_t *Sub) {
+  munmap(Sub->mapping, Sub->mapping_size);
+  if(Sub->payload_mapping) munmap(Sub->payload_mapping,
+                                  Sub->payload_mapping_size);
+
+  Sub->tuples  = NULL; Sub->keys = NULL; Sub->payloads = NULL;
+  Sub->mapping = Sub->payload_mapping = NULL;
+  Sub->mapping_size = Sub->payload_mapping_size = 0;
+}
+
+
+
+/*
+ * Writes `size` bytes at p to file fd, at offset `at`.
+ * Returns false if they could not be (entirely) written.
+ */
+static bool write_all(int fd, void *p, size_t size, off_t at) {
+  while(size > 0) { // pwrite() may write partially.
+    ssize_t n = pwrite(fd, p, size, at);
+    if(n <= 0) return false;
+
+    p = (char*)p + n; size -= n; at += n;
+  }
+
+  return true;
+}
+
+
+/*
+ * Writes relation Rel (i.e., its sub-relations, in order) to `path`, in its
+ * layout (rows, or columns if --columnar), with its keys' minimum, maximum
+ * and histogram.
+ * Returns false if the file could not be (entirely) written.
+ */
+bool relfile_write(relation_t *Rel, char *path) {
+  uint32_t          num_counts = 1 << RelFileHistoBits;
+  uint64_t         *Histo = SafeCalloc(num_counts, sizeof(uint64_t));
+  relfile_header_t  H = {.version = RelFileVersion, .layout = RelFileRows};
+
+  memcpy(H.magic, RelFileMagic, 8);
+  H.count         = Rel->size;
+  H.key_bytes     = KEY_BYTES;
+  H.payload_bytes = PAYLOAD_BYTES;
+  H.flags         = RelFileMinMax | RelFileHisto;
+  H.histo_bits    = RelFileHistoBits;
+  H.min_key       = UINT64_MAX;
+  H.max_key       = 0;
+
+  uint64_t histo_end = sizeof(H) + num_counts * sizeof(uint64_t);
+  H.data_offset = (histo_end + RelFileAlign - 1) / RelFileAlign * RelFileAlign;
+
+  if(Threads.columnar) {
+    uint64_t keys_end = H.data_offset + H.count * sizeof(tkey_t);
+    H.layout         = RelFileColumns;
+    H.payload_offset = (keys_end + RelFileAlign - 1) / RelFileAlign
+                       * RelFileAlign;
+  }
+
+  /* Statistics. */
+  for(uint32_t t = 0; t < Threads.N; t++) {
+    relation_t *Sub = (Rel->id == 'R') ? Threads.Args[t].SubR
+                                       : Threads.Args[t].SubS;
+
+    for(uint32_t i = 0; i < Sub->size; i++) {
+      tkey_t key = key_at(Sub, i);
+      H.min_key  = MIN(H.min_key, key);
+      H.max_key  = MAX(H.max_key, key);
+      Histo[key & (num_counts - 1)]++;
+    }
+  }
+
+  if(Rel->size == 0) H.min_key = 0;
+
+  /* Header, histogram and tuples (or keys and payloads). */
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  bool ok = (fd >= 0);
+
+  ok = ok && write_all(fd, &H, sizeof(H), 0);
+  ok = ok && write_all(fd, Histo, num_counts * sizeof(uint64_t), sizeof(H));
+
+  for(uint32_t t = 0; ok && t < Threads.N; t++) {
+    relation_t *Sub = (Rel->id == 'R') ? Threads.Args[t].SubR
+                                       : Threads.Args[t].SubS;
+    uint64_t    at  = Sub->offset;
+
+    if(Threads.columnar) {
+      ok = write_all(fd, Sub->keys, (size_t)Sub->size * sizeof(tkey_t),
+                     H.data_offset + at * sizeof(tkey_t)) &&
+           write_all(fd, Sub->payloads, (size_t)Sub->size * sizeof(tpayload_t),
+                     H.payload_offset + at * sizeof(tpayload_t));
+    }
+    else {
+      ok = write_all(fd, Sub->tuples, (size_t)Sub->size * sizeof(tuple_t),
+                     H.data_offset + at * sizeof(tuple_t));
+    }
+  }
+
+  if(fd >= 0) close(fd);
+  free(Histo);
+
+  return ok;
+}
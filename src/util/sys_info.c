@@ -4,6 +4,13 @@
  * SysInfo provides a relatively detailed description of the host machine
  * in terms of LLC capacity and line size, VM page size, and most importantly
  * a hierarchicy of LLC(s) > Physical Core(s) > Hardware Thread(s)/CPU(s).
+ * Each CPU is also tagged with its NUMA node, as listed in sysfs.
+ *
+ * The hierarchy need not be uniform: LLCs may have different numbers of
+ * cores, and cores different numbers of CPUs and speeds (e.g., hybrid parts
+ * with P-cores and E-cores). Each CPU's relative capacity is read from the
+ * kernel's ``cpu_capacity`` (or, on Intel hybrid parts, from the list of
+ * ``cpu_atom`` CPUs); cores are ranked into speed classes accordingly.
  *
  * Usage:  To initialize, call sys_info_prepare() with no arguments.
  *         To finalize, call sys_info_cleanup() with no arguments.
@@ -11,13 +18,13 @@
  *         global `SysInfo`.
  *         For detailed information about types, refer to ``util/sys_info.h``.
  *
- * TODO: Find reliable way to determine VM page size (w/ huge pages awareness).
- *       > Refer to note above function sys_info_prepare().
- *       > Potential options are via cat'ing
- *         # /sys/kernel/mm/transparent_hugepage/enabled
- *         # /proc/meminfo
- *       > getconf does not seem very reliable for this purpose, but may serve
- *         as a good fallback.
+ * Memory performance (bandwidth, latencies, TLB reach and barrier cost) is
+ * not probed here; nominal values are set in sys_info_prepare(), unless a
+ * machine profile is loaded (see ``util/calibrate.c``).
+ *
+ * VM page sizes and huge page availability (transparent huge pages, and free
+ * hugetlbfs pages) are read from sysconf(), /proc/meminfo and
+ * /sys/kernel/mm/transparent_hugepage/enabled; see prepare_page_info().
  *
  * TODO: Substitute m/calloc() -> SafeM/Calloc(), realloc() -> SafeRealloc().
  *       > To do so, SafeRealloc() needs to be written first (within util.c).
@@ -30,6 +37,8 @@
 #include <stdint.h>
 #include <limits.h>
 #include <string.h>
+#include <dirent.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "util/sys_info.h"
@@ -41,14 +50,21 @@ sys_info_t SysInfo;
 /* Helper Functions Declarations. */
 void prepare_llc_info();
 bool prepare_sys_hierarchy();
+void prepare_capacities(cpu_t*, uint32_t);
+void prepare_numa_info();
+void prepare_page_info();
+static bool cpu_list_has(const char*, uint32_t);
+
+/* Assumed capacity of E-cores, if the kernel doesn't report capacities. */
+#define ECORE_CAPACITY 614 // ~60% of a P-core (i.e., of 1024).
 
 
 /* Sets SysInfo.* and populates SysInfo.LLCs and its child Cores and CPUs.
  * On Failure to obtain SysInfo.llc_size, it aborts.
  * On Failure to properly populate SysInfo.LLCs, it aborts.
  *
- * Due to observed issues with asking the kernel for page size,
- * the page size is (conservatively) set to 2MiBs by default (not 4KiBs).
+ * SysInfo.page_size is the huge page size (2MiBs unless /proc/meminfo says
+ * otherwise), whether or not huge pages are actually available.
  */
 void sys_info_prepare() {
   /*
@@ -60,6 +76,23 @@ void sys_info_prepare() {
   SysInfo.llc_size  = 0; // bytes.
   SysInfo.line_size = 0; // bytes.
 
+  /*
+   * Memory performance, as used by the planner (see ``join/plan.c``).
+   * Nominal values of a current server; --calibrate measures them instead.
+   */
+  SysInfo.thread_bandwidth = 15.0; // bytes/ns (i.e., GB/s).
+  SysInfo.llc_bandwidth    = 40.0; // bytes/ns.
+  SysInfo.node_bandwidth   = 60.0; // bytes/ns.
+  SysInfo.llc_latency      = 20.0; // ns.
+  SysInfo.mem_latency      = 90.0; // ns.
+  SysInfo.mem_parallelism  = 4.0;
+  SysInfo.tlb_entries      = 1536;
+  SysInfo.tlb_miss_latency = 30.0; // ns.
+  SysInfo.barrier_latency  = 2000.0; // ns.
+
+  /* Attempt to set SysInfo.*page_size, SysInfo.thp, SysInfo.hugetlb_pages. */
+  prepare_page_info();
+
   /* Attempt to set SysInfo.llc_level, SysInfo.llc_size, SysInfo.line_size. */
   prepare_llc_info();
 
@@ -86,6 +119,9 @@ void sys_info_prepare() {
     abort();
   }
 
+  /* Set SysInfo.num_nodes and each CPU's node (all zero if unknown). */
+  prepare_numa_info();
+
   return;
 }
 
@@ -100,6 +136,46 @@ void sys_info_cleanup() {
 }
 
 
+/* Sets SysInfo.base_page_size, and SysInfo.page_size, SysInfo.thp and
+ * SysInfo.hugetlb_pages as available. On failure to obtain a huge page item,
+ * it is untouched (or, for SysInfo.thp, set to 'n'ever).
+ */
+void prepare_page_info() {
+  char buffer[LINEMAX];
+  uint64_t value;
+  FILE* file;
+
+  SysInfo.base_page_size = sysconf(_SC_PAGESIZE);
+  SysInfo.thp            = 'n';
+  SysInfo.hugetlb_pages  = 0;
+
+  /* Huge page size and free hugetlbfs pages. */
+  if((file = fopen("/proc/meminfo", "r"))) {
+    while(fgets(buffer, LINEMAX, file)) {
+      if(sscanf(buffer, "Hugepagesize: %lu kB", &value) == 1) {
+        SysInfo.page_size = value * 1024;
+      }
+      if(sscanf(buffer, "HugePages_Free: %lu", &value) == 1) {
+        SysInfo.hugetlb_pages = value;
+      }
+    }
+
+    fclose(file);
+  }
+
+  /* THP mode, printed as, e.g., "always [madvise] never". */
+  if((file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r"))) {
+    if(fgets(buffer, LINEMAX, file) && strchr(buffer, '[')) {
+      SysInfo.thp = strchr(buffer, '[')[1];
+    }
+
+    fclose(file);
+  }
+
+  return;
+}
+
+
 /* Sets SysInfo.llc_level, SysInfo.llc_size and SysInfo.line_size.
  * On failure to obtain a value, the corresponding item is untouched.
  */
@@ -170,11 +246,18 @@ bool prepare_sys_hierarchy() {
   pipe = popen("lscpu -b -p=cache | grep -o -e 'L1.*'", "r");
   if(!pipe || !fgets(buffer, LINEMAX, pipe)) return false;
 
+  /*
+   * Older ``lscpu`` versions print caches as one column, "L1d:L1i:L2:L3",
+   * while newer ones print an empty column followed by one column per cache.
+   */
+  char separator = strchr(buffer, ':') ? ':' : ',';
+  if(separator == ',') strcat(format, ",");
+
   /* Format <==> "%d, %d, (%*d:)* %d" [CPU, Core, ..., LLC]. */
   for(uint32_t i = 0; buffer[i]; i++) {
     // Ignore all caches higher than LLC.
-    if(buffer[i] != ':') continue;
-    strcat(format, "%*d:");
+    if(buffer[i] != separator) continue;
+    strcat(format, separator == ':' ? "%*d:" : "%*d,");
 
     // Terminate loop on ``Lx`` where x == llc_level.
     if(buffer[++i] == 'L' && buffer[++i] == 0x30+SysInfo.llc_level /*ASCII*/) {
@@ -216,14 +299,21 @@ bool prepare_sys_hierarchy() {
   // Cleanup.
   pclose(pipe);
 
+  /* Set the relative capacity of each CPU. */
+  prepare_capacities(CPUs, num_cpus);
+
   /* Allocate arrays for Cores and LLCs. */
   core_t *Cores = calloc(num_cores, sizeof(core_t));
   llc_t  *LLCs  = calloc(num_llcs,  sizeof(llc_t));
 
-  // Set the number of CPUs (as well as the parent LLC) for each core.
+  // Set the number of CPUs (as well as the parent LLC) for each core,
+  // and the number of CPUs and capacity of each LLC.
   for(uint32_t i = 0; i < num_cpus; i++) {
     Cores[CPUs[i].core].num_cpus++;
-    Cores[CPUs[i].core].llc = CPUs[i].llc;
+    Cores[CPUs[i].core].llc      = CPUs[i].llc;
+    Cores[CPUs[i].core].capacity = CPUs[i].capacity;
+    LLCs[CPUs[i].llc].num_cpus++;
+    LLCs[CPUs[i].llc].capacity  += CPUs[i].capacity;
   }
 
   // Prepare the data in Cores, set number of cores for each LLC,
@@ -278,6 +368,48 @@ bool prepare_sys_hierarchy() {
     llc->Cores[llc->num_cores++] = core;
   }
 
+  // Rank cores into speed classes, by distinct capacity (descending).
+  uint32_t Classes[num_cores]; // Distinct capacities, descending.
+  uint32_t num_classes = 0;
+
+  for(uint32_t i = 0; i < num_cores; i++) {
+    uint32_t c = 0, capacity = Cores[i].capacity;
+    while(c < num_classes && Classes[c] > capacity) c++;
+    if(c < num_classes && Classes[c] == capacity) continue;
+
+    memmove(Classes + c + 1, Classes + c, (num_classes++ - c) * sizeof(uint32_t));
+    Classes[c] = capacity;
+  }
+
+  for(uint32_t i = 0; i < num_cores; i++) {
+    while(Classes[Cores[i].speed_class] != Cores[i].capacity) {
+      Cores[i].speed_class++;
+    }
+  }
+
+  SysInfo.num_speed_classes = num_classes;
+
+  // List each LLC's cores fastest first (stable insertion sort).
+  for(uint32_t i = 0; i < num_llcs; i++) {
+    core_t **C = LLCs[i].Cores;
+
+    for(uint32_t j = 1; j < LLCs[i].num_cores; j++) {
+      core_t *core = C[j];
+      uint32_t k   = j;
+      for(; k > 0 && C[k-1]->speed_class > core->speed_class; k--) C[k] = C[k-1];
+      C[k] = core;
+    }
+  }
+
+  // Flag non-uniform hierarchies.
+  SysInfo.heterogeneous = (SysInfo.num_speed_classes > 1);
+  for(uint32_t i = 0; i < num_llcs; i++) {
+    SysInfo.heterogeneous |= (LLCs[i].num_cores != SysInfo.cores_per_llc);
+  }
+  for(uint32_t i = 0; i < num_cores; i++) {
+    SysInfo.heterogeneous |= (Cores[i].num_cpus != SysInfo.cpus_per_core);
+  }
+
   // Update SysInfo appropriately.
   SysInfo.LLCs  = LLCs;
   SysInfo.Cores = Cores;
@@ -288,3 +420,117 @@ bool prepare_sys_hierarchy() {
 
   return true;
 }
+
+
+
+/* Sets the relative capacity of each CPU (1024 for the fastest CPUs).
+ * Sources, in order of preference:
+ *  (a) /sys/devices/system/cpu/cpu<id>/cpu_capacity, as scaled by the kernel.
+ *  (b) /sys/devices/cpu_atom/cpus, listing the E-cores of Intel hybrid parts.
+ * Otherwise, all CPUs are assumed to be equally fast.
+ */
+void prepare_capacities(cpu_t *CPUs, uint32_t num_cpus) {
+  char path[LINEMAX], buffer[LINEMAX];
+  uint32_t max_capacity = 0;
+  FILE* file;
+
+  for(uint32_t i = 0; i < num_cpus; i++) CPUs[i].capacity = 1024;
+
+  /* (a) Kernel-reported capacities. */
+  for(uint32_t i = 0; i < num_cpus; i++) {
+    snprintf(path, LINEMAX, "/sys/devices/system/cpu/cpu%u/cpu_capacity",
+             CPUs[i].id);
+
+    if(!(file = fopen(path, "r"))) break;
+    if(fscanf(file, "%u", &CPUs[i].capacity) != 1) CPUs[i].capacity = 1024;
+    fclose(file);
+
+    max_capacity = MAX(max_capacity, CPUs[i].capacity);
+  }
+
+  if(max_capacity > 0) {
+    for(uint32_t i = 0; i < num_cpus; i++) {
+      CPUs[i].capacity = MAX(1, CPUs[i].capacity * 1024 / max_capacity);
+    }
+    return;
+  }
+
+  /* (b) Intel hybrid: CPUs listed as "a-b,c,..." under cpu_atom. */
+  if(!(file = fopen("/sys/devices/cpu_atom/cpus", "r"))) return;
+
+  if(fgets(buffer, LINEMAX, file)) {
+    for(uint32_t i = 0; i < num_cpus; i++) {
+      if(cpu_list_has(buffer, CPUs[i].id)) CPUs[i].capacity = ECORE_CAPACITY;
+    }
+  }
+
+  fclose(file);
+
+  return;
+}
+
+
+
+/* Sets SysInfo.num_nodes and the NUMA node of each CPU in SysInfo.CPUs,
+ * from /sys/devices/system/node/node<id>/cpulist.
+ * If unavailable (e.g., a non-NUMA kernel), a single node zero is assumed.
+ */
+void prepare_numa_info() {
+  char path[LINEMAX], buffer[LINEMAX];
+  struct dirent *entry;
+  uint32_t node;
+  DIR* dir;
+
+  SysInfo.num_nodes = 1;
+  for(uint32_t i = 0; i < SysInfo.num_cpus; i++) SysInfo.CPUs[i].node = 0;
+
+  if(!(dir = opendir("/sys/devices/system/node"))) return;
+
+  while((entry = readdir(dir))) {
+    if(sscanf(entry->d_name, "node%u", &node) != 1) continue;
+
+    snprintf(path, LINEMAX, "/sys/devices/system/node/%s/cpulist",
+             entry->d_name);
+
+    FILE* file = fopen(path, "r");
+    if(!file) continue;
+
+    if(fgets(buffer, LINEMAX, file)) {
+      for(uint32_t i = 0; i < SysInfo.num_cpus; i++) {
+        if(cpu_list_has(buffer, SysInfo.CPUs[i].id)) SysInfo.CPUs[i].node = node;
+      }
+    }
+
+    fclose(file);
+
+    // Node IDs need not be contiguous; size per-node tables by the maximum.
+    SysInfo.num_nodes = MAX(SysInfo.num_nodes, node + 1);
+  }
+
+  closedir(dir);
+
+  return;
+}
+
+
+
+/* Returns true iff CPU `id` is in `list`, formatted by the kernel as
+ * "a-b,c,...".
+ */
+static bool cpu_list_has(const char *list, uint32_t id) {
+  while(*list) {
+    uint32_t first, last;
+    int n = sscanf(list, "%u-%u", &first, &last);
+    if(n < 1) return false;
+    if(n == 1) last = first;
+
+    if(id >= first && id <= last) return true;
+
+    // Next range.
+    list = strchr(list, ',');
+    if(!list) return false;
+    list++;
+  }
+
+  return false;
+}
@@ -7,13 +7,16 @@
 #ifndef _SYS_INFO_TYPES_
   #define _SYS_INFO_TYPES_
 
-  #include <stdint.h> /* uint32_t */
+  #include <stdint.h>  /* uint32_t */
+  #include <stdbool.h> /* bool */
 
   /* CPU Type Definition. */
   typedef struct {
     uint32_t id;   // Kernel's CPU ID; not necessarily sequential.
     uint32_t core; // Physical core (parent) of CPU.
     uint32_t llc;  // LLC ID, parent of core.
+    uint32_t capacity; // Relative throughput; 1024 for the fastest CPUs.
+    uint32_t node;     // NUMA node ID (0 if NUMA is unknown).
   } cpu_t;
 
 
@@ -23,6 +26,8 @@
     uint32_t num_cpus; // Number of CPUs on physical core (hyperthreads).
     cpu_t  **CPUs;     // List of CPUs.
     uint32_t llc;      // LLC ID, parent to CPU.
+    uint32_t capacity;    // Capacity of core's CPUs (see cpu_t).
+    uint32_t speed_class; // 0 for the fastest cores (e.g., P-cores), 1, ...
   } core_t;
 
 
@@ -30,17 +35,42 @@
   typedef struct {
     uint32_t id;          // LLC ID.
     uint32_t num_cores;   // Number of physical cores on LLC.
-    core_t  **Cores;      // List of Cores.
+    core_t  **Cores;      // List of Cores (fastest speed class first).
+    uint32_t num_cpus;    // Number of CPUs (hardware contexts) on LLC.
+    uint32_t capacity;    // Sum of capacities of LLC's CPUs.
   } llc_t;
 
 
+  /* Radices (0 unused) of calibrated scatter throughput (see calibrate.c). */
+  #define CALIBRATED_RADICES 15
+
+
   /* ``SysInfo`` Type. */
   typedef struct {
     /* Hardware Stats. */
     uint8_t  llc_level; /* L1, L2 or L3 is LLC? */
     uint64_t llc_size;  /* In Bytes. */
     uint64_t line_size; /* Last-level cache line size. */
-    uint64_t page_size;
+    uint64_t page_size;      /* Huge page size (alignment of large buffers). */
+    uint64_t base_page_size; /* Base (e.g., 4KiB) VM page size. */
+    char     thp;            /* Transparent huge pages: 'a'lways, 'm'advise
+                                or 'n'ever [sysfs]. */
+    uint64_t hugetlb_pages;  /* Free hugetlbfs pages of page_size at start. */
+    uint32_t num_nodes; /* NUMA nodes; node IDs are less than this. */
+
+    /* Memory Performance (nominal, unless calibrated; see util/calibrate.c),
+     * as used by the planner (see join/plan.c). */
+    double   thread_bandwidth; /* Sequential, by one CPU alone [B/ns]. */
+    double   llc_bandwidth;    /* Sequential, by all CPUs of an LLC [B/ns]. */
+    double   node_bandwidth;   /* Sequential, per NUMA node [B/ns]. */
+    double   llc_latency;      /* Random access, within the LLC [ns]. */
+    double   mem_latency;      /* Random access, beyond the LLC [ns]. */
+    double   mem_parallelism;  /* Independent random accesses in flight. */
+    uint32_t tlb_entries;      /* Last-level TLB entries (reach, in pages). */
+    double   tlb_miss_latency; /* Page walk, beyond the TLB's reach [ns]. */
+    double   barrier_latency;  /* One barrier across all CPUs [ns]. */
+    double   scatter_ns[CALIBRATED_RADICES]; /* ICP, per tuple and fanout 2^r
+                                                [ns; 0 if not calibrated]. */
 
     /* LLC(s) > Core(s) > CPU(s) Hierarchical Structure. */
     llc_t   *LLCs;
@@ -53,6 +83,8 @@
     /* Hierarchical Structure Stats. */
     uint32_t cores_per_llc; // If variation exists, these are set to
     uint32_t cpus_per_core; // the minimum, non-zero value.
+    uint32_t num_speed_classes; // > 1 on hybrid (e.g., P-/E-core) parts.
+    bool     heterogeneous;     // Uneven LLCs/cores, or > 1 speed class.
   } sys_info_t;
 
 
@@ -0,0 +1,218 @@
+/*
+ * PolyHJ: Polymorphic Hash Join.
+ * Text (CSV) Relation Files.
+ *
+ * One tuple per line: a key, then optionally a separator (',', ';', tab or
+ * spaces) and a payload (otherwise zero), both unsigned decimal integers.
+ * The largest payload (e.g., 2^32 - 1) is reserved (see ColBP_I()).
+ * Key-only builds (see TUPLE_WIDTH in types.h) ignore payloads.
+ * A first line not starting with a digit is skipped as a header.
+ *
+ * (a) textfile_open(Rel) maps the file, counts its lines (by memchr()) to
+ *     set Rel->size, and records the byte offset of every `TextStride`-th
+ *     line.
+ * (b) textfile_load(tid, Rel, Sub) parses the sub-relation's lines, by the
+ *     thread that owns it, directly into its NUMA-local tuples (or columns).
+ *     The thread finds its first line from the nearest recorded offset;
+ *     hence, threads parse disjoint byte ranges, aligned on newlines, in
+ *     parallel. Integers are parsed eight digits at a time (see parse_uint()).
+ * (c) textfile_cleanup() unmaps the files.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+
+/* Constants. */
+#define TextStride (1 << 16) // Lines between recorded offsets.
+#define Ones       0x0101010101010101ULL
+
+/* Mapped Text File (one per relation). */
+typedef struct {
+  char     *text;
+  size_t    size;
+  uint64_t *Offsets;  // Offsets[j]: byte offset of line j * TextStride.
+} textfile_t;
+
+/* Global Variables. */
+static textfile_t Files[2]; // Of relations R and S.
+
+
+/*
+ * Reports an unusable text file and exits.
+ */
+static void textfile_error(relation_t *Rel, char *reason, uint64_t line) {
+  printf(">> Cannot load relation file ``%s``: %s (tuple %lu).\n",
+         Rel->path, reason, line);
+  exit(1);
+}
+
+
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+
+/*
+ * Parses an unsigned decimal integer at *p (before end), advancing *p.
+ * Fast path: for each 8 bytes, locate the first non-digit byte and convert
+ * the (up to 8) leading digits at once, by SWAR multiply-adds.
+ * Returns false if there is no digit at *p, or on overflow.
+ */
+static inline bool parse_uint(char **p, char *end, uint64_t *value) {
+  char    *s = *p;
+  uint64_t v = 0;
+  uint32_t digits = 0;
+
+  while(end - s >= 8) {
+    uint64_t w;
+    memcpy(&w, s, 8);
+
+    /* Digits become 0..9; any other byte, 10..255. */
+    uint64_t x    = w ^ (0x30 * Ones);
+    uint64_t mask = ((x + 0x76 * Ones) | x) & (0x80 * Ones);
+    uint32_t len  = mask ? __builtin_ctzll(mask) / 8 : 8;
+    if(len == 0) break;
+
+    /* Right-align the digits (first digit most significant), and combine. */
+    x <<= 8 * (8 - len);
+    x   = (x * 10) + (x >> 8);
+    x   = (((x & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+           (((x >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))))
+          >> 32;
+
+    static const uint64_t Pow10[9] = {1, 10, 100, 1000, 10000, 100000,
+                                      1000000, 10000000, 100000000};
+    v       = v * Pow10[len] + x;
+    s      += len;
+    digits += len;
+
+    if(len < 8) { *p = s; *value = v; return digits > 0 && digits <= 19; }
+  }
+
+  /* Remaining (last) bytes. */
+  while(s < end && is_digit(*s)) { v = v * 10 + (*s++ - '0'); digits++; }
+
+  *p = s; *value = v;
+  return digits > 0 && digits <= 19;
+}
+
+
+
+/*
+ * Maps Rel->path, sets Rel->size to its number of tuples, and records the
+ * offsets of every TextStride-th line.
+ */
+void textfile_open(relation_t *Rel) {
+  textfile_t *F = Files + (Rel->id == 'S');
+  struct stat st;
+
+  int fd = open(Rel->path, O_RDONLY);
+  if(fd < 0 || fstat(fd, &st) != 0) textfile_error(Rel, "unable to open", 0);
+
+  F->size = st.st_size;
+  F->text = (F->size > 0)
+          ? mmap(NULL, F->size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  assert(F->text != MAP_FAILED);
+  close(fd);
+
+  if(F->size > 0) madvise(F->text, F->size, MADV_SEQUENTIAL);
+
+  /* Skip a header line. */
+  char *p = F->text, *end = F->text + F->size;
+  if(p < end && !is_digit(*p)) {
+    p = memchr(p, '\n', end - p);
+    p = p ? p + 1 : end;
+  }
+
+  /* Count lines, recording every TextStride-th offset. */
+  uint64_t lines = 0, max_offsets = 16;
+  F->Offsets = SafeMalloc(max_offsets * sizeof(uint64_t));
+
+  while(p < end) {
+    if(lines % TextStride == 0) {
+      if(lines / TextStride == max_offsets) {
+        max_offsets *= 2;
+        F->Offsets = realloc(F->Offsets, max_offsets * sizeof(uint64_t));
+        assert(F->Offsets != NULL);
+      }
+      F->Offsets[lines / TextStride] = p - F->text;
+    }
+
+    lines++;
+    p = memchr(p, '\n', end - p);
+    p = p ? p + 1 : end;
+  }
+
+  if(lines > UINT32_MAX) textfile_error(Rel, "too many tuples", lines);
+
+  Rel->size = lines;
+}
+
+
+/*
+ * Parses Sub, of Rel, from Rel->path into tuples, for thread tid.
+ */
+void textfile_load(uint32_t tid, relation_t *Rel, relation_t *Sub) {
+  textfile_t *F = Files + (Rel->id == 'S');
+
+  Sub->mapping = Sub->payload_mapping = NULL;
+  Sub->mapping_size = Sub->payload_mapping_size = 0;
+  Sub->min_key = UINT64_MAX;
+  Sub->max_key = 0;
+  sub_alloc(tid, Sub);
+  if(Sub->size == 0) return;
+
+  /* Find own first line. */
+  char *p   = F->text + F->Offsets[Sub->offset / TextStride];
+  char *end = F->text + F->size;
+
+  for(uint32_t skip = Sub->offset % TextStride; skip > 0; skip--) {
+    p = (char*)memchr(p, '\n', end - p) + 1;
+  }
+
+  /* Parse own lines. */
+  for(uint32_t i = 0; i < Sub->size; i++) {
+    uint64_t key, payload = 0;
+
+    if(!parse_uint(&p, end, &key) || key > (tkey_t)-1) {
+      textfile_error(Rel, "invalid key", (uint64_t)Sub->offset + i + 1);
+    }
+
+    char *q = p;
+    while(q < end && (*q == ',' || *q == ';' || *q == '\t' || *q == ' ')) q++;
+
+    if(q > p && q < end && is_digit(*q)) {
+      p = q;
+      if(!parse_uint(&p, end, &payload) || payload >= (tpayload_t)-1) {
+        textfile_error(Rel, "invalid payload", (uint64_t)Sub->offset + i + 1);
+      }
+    }
+    else p = q;
+
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    if(p < end && *p++ != '\n') {
+      textfile_error(Rel, "invalid line", (uint64_t)Sub->offset + i + 1);
+    }
+
+    tuple_set(Sub, i, make_tuple(key, payload));
+    Sub->min_key   = MIN(Sub->min_key, key);
+    Sub->max_key   = MAX(Sub->max_key, key);
+  }
+}
+
+
+/*
+ * Unmaps the text files, if any.
+ */
+void textfile_cleanup() {
+  for(uint32_t r = 0; r < 2; r++) {
+    if(Files[r].text) munmap(Files[r].text, Files[r].size);
+    free(Files[r].Offsets);
+    Files[r] = (textfile_t){0};
+  }
+}
@@ -3,7 +3,8 @@
  *
  * (a) prepare_threads_meta()
  * (b) prepare_threads_meta_cleanup()
- * (c) run_threads()
+ * (c) threads_regroup()
+ * (d) run_threads(), backed by a persistent pool of pinned workers.
  */
 
 #ifndef _GNU_SOURCE
@@ -17,13 +18,22 @@
 #include <sched.h>
 #include "common.h"
 
+/* Helper Function(s) Declarations. */
+static void pool_stop();
+
 
 /*
  * Prepares and popluates Threads.Args, assigning each thread a CPU.
  *
- * If the --favor_hyperthreading flag is passed (or the default is changed
- * from ``main.c``), then Threads.favor_physical_cores would be false.
- * Otherwise, it's true by default.
+ * Placement follows the --sched policy:
+ *   # tight (default): favor_physical_cores, on as few LLCs as possible.
+ *   # hypertight:      favor hyperthreads, on as few LLCs as possible.
+ *   # loose:           favor_physical_cores, spread across all LLCs
+ *                      (i.e., Threads.use_all_llcs), which helps the
+ *                      bandwidth-bound phases (e.g., ICP, Model III probing).
+ *
+ * If the policy is hypertight (or the default is changed from ``main.c``),
+ * then Threads.favor_physical_cores would be false. Otherwise, it's true.
  *
  * If true, and enough physical cores exist on the host machine to satisfy
  * all required threads, then each thread is pinned to a distinct physical
@@ -33,91 +43,122 @@
  * If false, and enough cores/hyperthreads exist on x LLC(s), then only
  * x LLC(s) are used, with hyperthreading (only) if necessary.
  *
- * NOTE: Rejects Thread.N > Available # of CPUs, since it tries to pin each
- *       thread to a unique hardware context. Perhaps, TODO, accept such input.
+ * LLCs need not be uniform: those with more usable contexts are preferred,
+ * faster cores (see speed classes in ``util/sys_info.c``) are used first,
+ * and threads of an LLC that is full overflow onto other utilized LLCs.
+ * Shares of R and S are sized in proportion to each thread's throughput.
+ *
+ * Groups are logical: thread t always belongs to group t % x, which the
+ * joins rely on (`tid % num_groups == group`), and group g is homed on the
+ * g-th utilized LLC. Only threads that overflow run off their group's LLC;
+ * they stay in their group (sharing its table and barrier node), at the
+ * cost of remote-LLC accesses. On uniform LLCs, no thread overflows.
  *
+ * If Threads.N exceeds the available hardware contexts, all contexts are
+ * used and several threads share each CPU (Threads.oversubscribed). Waiting
+ * threads then yield their CPU (see spin_relax() in ``common.h``) rather
+ * than spin.
  */
 void prepare_threads_meta() {
-  uint32_t cpus_per_core = SysInfo.cpus_per_core;
-  uint32_t cores_per_llc = SysInfo.cores_per_llc;
-  uint32_t cpus_per_llc  = cpus_per_core * cores_per_llc;
-
-  // Limit (utilized) ``cpus_per_core`` to one, if conditions are satisfied.
-  if(Threads.favor_physical_cores && SysInfo.num_cores >= Threads.N) {
-    cpus_per_core = 1;
-    cpus_per_llc  = cores_per_llc;
+  uint32_t num_llcs = SysInfo.num_llcs;
+  llc_t   *LLCs     = SysInfo.LLCs;
+
+  // Limit (utilized) CPUs per core to one, if conditions are satisfied.
+  bool one_per_core = Threads.favor_physical_cores &&
+                      SysInfo.num_cores >= Threads.N;
+
+  // Order LLCs by their # of usable contexts (descending; stable).
+  uint32_t order[num_llcs];  // LLC IDs, in order of preference.
+  uint32_t usable[num_llcs]; // # of usable contexts on LLC.
+
+  for(uint32_t l = 0; l < num_llcs; l++) {
+    uint32_t k = l;
+    usable[l] = one_per_core ? LLCs[l].num_cores : LLCs[l].num_cpus;
+
+    for(; k > 0 && usable[order[k-1]] < usable[l]; k--) order[k] = order[k-1];
+    order[k] = l;
   }
 
   // Determine the minimum sufficient number of LLCs to run CPUs on.
-  uint32_t utilized_llcs = div_ceil(Threads.N, cpus_per_llc);
+  uint32_t utilized_llcs = 0, contexts = 0;
+  while(utilized_llcs < num_llcs && contexts < Threads.N) {
+    contexts += usable[order[utilized_llcs++]];
+  }
+
+  // Under the loose policy, rather use as many LLCs as there are threads.
+  if(Threads.use_all_llcs) {
+    while(utilized_llcs < MIN(num_llcs, Threads.N)) {
+      contexts += usable[order[utilized_llcs++]];
+    }
+  }
+
+  // Not enough hardware contexts: oversubscribe all of them.
+  Threads.oversubscribed = (contexts < Threads.N);
+
+  if(Threads.oversubscribed) {
+    printf("Warning: %d threads exceed the %d usable hardware contexts; "
+           "oversubscribing.\n", Threads.N, SysInfo.num_cpus);
+    one_per_core = false;
+  }
 
   // Determine the number of (hyper)threads to be run on each core.
-  uint32_t utilizable_cores       = utilized_llcs * cores_per_llc;
-  uint32_t utilized_cpus_per_core = div_ceil(Threads.N, utilizable_cores);
-
-  if(utilized_llcs > SysInfo.num_llcs) {
-    printf("Warning: Cannot run with %d threads.\n", Threads.N);
-    printf("On this machine, the driver supports up to %d threads.\n",
-           SysInfo.num_llcs * SysInfo.cores_per_llc * SysInfo.cpus_per_core);
-    if(Threads.N <= SysInfo.num_cpus)
-      puts("Possible Reason: Different # of cores/contexts on different LLCs?");
-    abort();
+  uint32_t utilizable_cores = 0;
+  for(uint32_t g = 0; g < utilized_llcs; g++) {
+    utilizable_cores += LLCs[order[g]].num_cores;
   }
 
+  uint32_t utilized_cpus_per_core = one_per_core ? 1 :
+                                    div_ceil(Threads.N, utilizable_cores);
+
   /* Prepare and populate the Threads.Args array. */
   Threads.Args          = SafeCalloc(Threads.N, sizeof(thread_t));
   Threads.num_groups    = utilized_llcs;
   Threads.utilized_llcs = utilized_llcs;
-  Threads.utilized_cpus_per_core = utilized_cpus_per_core;
 
   // Data about mapping threads to CPUs.
-  uint32_t  llc = 0;                        // ID of current LLC.
-  uint32_t cores_on_llc[utilized_llcs];     // # of cores used so far on LLC.
-  uint32_t cpus_on_core[SysInfo.num_cores]; // # of CPUs used so far on core.
+  uint32_t cpus_on_core[SysInfo.num_cores]; // # of threads so far on core.
+  uint32_t threads_on_cpu[SysInfo.num_cpus]; // # of threads so far on CPU.
 
-  memset(cores_on_llc, 0, utilized_llcs     * sizeof(uint32_t));
-  memset(cpus_on_core, 0, SysInfo.num_cores * sizeof(uint32_t));
-
-  // Data about thread's shares from each relation.
-  relation_t *RelR           = Threads.RelR;
-  relation_t *RelS           = Threads.RelS;
-  uint32_t R_section         = RelR->size / Threads.N;
-  uint32_t S_section         = RelS->size / Threads.N;
-  const uint32_t R_remainder = RelR->size % Threads.N;
-  const uint32_t S_remainder = RelS->size % Threads.N;
-  uint32_t R_leftover        = R_remainder;
-  uint32_t S_leftover        = S_remainder;
-
-  assert(Threads.N <= SysInfo.num_cpus);
+  memset(cpus_on_core,   0, SysInfo.num_cores * sizeof(uint32_t));
+  memset(threads_on_cpu, 0, SysInfo.num_cpus  * sizeof(uint32_t));
 
   // For each thread, populate values and assign a CPU.
   for(uint32_t t = 0; t < Threads.N; t++) {
-    thread_t *T = Threads.Args + t;
-
-    // Set basic meta-data.
-    T->tid  = t;
-    T->SubR = SafeMalloc(sizeof(relation_t));
-    T->SubS = SafeMalloc(sizeof(relation_t));
+    thread_t *T    = Threads.Args + t;
+    core_t   *core = NULL;
+
+    // Set basic meta-data. Thread t belongs to group t % x, homed on the
+    // (t % x)-th utilized LLC, even if it overflows below (see above).
+    T->tid   = t;
+    T->group = t % utilized_llcs;
+    T->SubR  = SafeCalloc(1, sizeof(relation_t));
+    T->SubS  = SafeCalloc(1, sizeof(relation_t));
     T->SubR->id = 'R'; T->SubS->id = 'S';
-    T->SubR->offset = t*R_section + ( R_remainder - R_leftover );
-    T->SubS->offset = t*S_section + ( S_remainder - S_leftover );
-    T->SubR->size   = R_section + (R_leftover > 0 && R_leftover--);
-    T->SubS->size   = S_section + (S_leftover > 0 && S_leftover--);
-
-    // Pick a CPU and set LLC group data.
-    core_t *core = SysInfo.LLCs[llc].Cores[ cores_on_llc[llc] ];
 
-    T->group = llc;
-    T->CPU   = core->CPUs[ cpus_on_core[core->id]++ ];
-
-    // If we have already placed enough (hyper)threads on current core,
-    if(cpus_on_core[core->id] == utilized_cpus_per_core) {
-      // Then, later, continue with next available core on the current LLC.
-      cores_on_llc[llc]++;
+    /*
+     * Pick the first (i.e., fastest) core on the group's LLC that has fewer
+     * than utilized_cpus_per_core threads. On uneven LLCs, overflow onto
+     * the other utilized LLCs; if all are full, allow one more thread per
+     * core (beyond its CPUs only when oversubscribed).
+     */
+    while(core == NULL) {
+      for(uint32_t g = 0; g < utilized_llcs && core == NULL; g++) {
+        llc_t *llc = LLCs + order[(T->group + g) % utilized_llcs];
+
+        for(uint32_t c = 0; c < llc->num_cores && core == NULL; c++) {
+          core_t  *candidate = llc->Cores[c];
+          uint32_t limit     = utilized_cpus_per_core;
+          if(!Threads.oversubscribed) limit = MIN(limit, candidate->num_cpus);
+
+          if(cpus_on_core[candidate->id] < limit) core = candidate;
+        }
+      }
+
+      if(core == NULL) utilized_cpus_per_core++;
     }
 
-    // Let the next thread be on the "next" (utilized) LLC.
-    llc = (llc + 1) % utilized_llcs;
+    T->CPU = core->CPUs[ cpus_on_core[core->id]++ % core->num_cpus ];
+    threads_on_cpu[T->CPU - SysInfo.CPUs]++;
 
     /* Print Thread-CPU mapping. */
     /*
@@ -126,6 +167,41 @@ void prepare_threads_meta() {
     */
   }
 
+  Threads.utilized_cpus_per_core = utilized_cpus_per_core;
+
+
+  /*
+   * Size each thread's shares of R and S in proportion to its throughput,
+   * i.e., its CPU's capacity divided among the threads sharing the CPU.
+   * On uniform machines, this is |Rel| / Threads.N (plus one, for the first
+   * |Rel| % Threads.N threads).
+   */
+  uint64_t weights[Threads.N], total_weight = 0;
+
+  for(uint32_t t = 0; t < Threads.N; t++) {
+    cpu_t *cpu    = Threads.Args[t].CPU;
+    weights[t]    = (uint64_t)cpu->capacity * 1024 / threads_on_cpu[cpu - SysInfo.CPUs];
+    total_weight += weights[t];
+  }
+
+  for(uint32_t r = 0; r < 2; r++) {
+    relation_t *Rel      = (r == 0) ? Threads.RelR : Threads.RelS;
+    uint32_t    leftover = Rel->size, offset = 0;
+
+    for(uint32_t t = 0; t < Threads.N; t++) {
+      relation_t *Sub = (r == 0) ? Threads.Args[t].SubR : Threads.Args[t].SubS;
+      Sub->size = (uint64_t)Rel->size * weights[t] / total_weight;
+      leftover -= Sub->size;
+    }
+
+    for(uint32_t t = 0; t < Threads.N; t++) {
+      relation_t *Sub = (r == 0) ? Threads.Args[t].SubR : Threads.Args[t].SubS;
+      Sub->size  += (leftover > 0 && leftover--);
+      Sub->offset = offset;
+      offset     += Sub->size;
+    }
+  }
+
 
   /* Initialize the threads' barriers. */
   barrier_init();
@@ -134,28 +210,106 @@ void prepare_threads_meta() {
 }
 
 
+/*
+ * Reduces Threads.num_groups to the largest power of two that divides it
+ * and does not exceed `max_groups`, re-assigning T->group = tid % num_groups.
+ * Since threads are placed on utilized LLCs round-robin, each new group g
+ * is the union of the LLCs g, g + num_groups, g + 2 * num_groups, ... (in
+ * the order of preference), rather than of adjacent ones; merging adjacent
+ * LLCs would break `tid % num_groups == group`, which the joins rely on.
+ */
+void threads_regroup(uint32_t max_groups) {
+  uint32_t groups = Threads.num_groups & (~Threads.num_groups + 1);
+  groups = MIN(groups, max_groups);
+
+  if(groups == Threads.num_groups) return;
+
+  Threads.num_groups = groups;
+  for(uint32_t t = 0; t < Threads.N; t++) Threads.Args[t].group = t % groups;
+
+  /* Re-initialize the barriers, which follow the groups. */
+  barrier_cleanup();
+  barrier_init();
+
+  return;
+}
+
+
 /*
  * Cleanup for prepare_threads_meta() by free()`ing its allocations.
+ * Also terminates the worker pool, which runs on Threads.Args.
  */
 void prepare_threads_meta_cleanup() {
+  pool_stop();
+  barrier_cleanup();
+
   for(uint32_t t = 0; t < Threads.N; t++) {
     free(Threads.Args[t].SubR);
     free(Threads.Args[t].SubS);
+    arena_cleanup(Threads.Args + t);
   }
 
   free(Threads.Args);
 }
 
 
+/*** Persistent Worker Pool. ***/
+
 /*
- * (a) Runs `Threads.N` threads with f((void*) Args), assigning each thread to
- * its respective CPU.
- * (b) Waits for all threads to complete execution, before returning.
+ * Workers are created (and pinned) once, on the first call to run_threads().
+ * Each waits for a new task generation, spinning briefly before sleeping on
+ * a condition variable, runs the task on its own Threads.Args entry and then
+ * reports completion. A NULL task terminates the workers.
  */
-void run_threads(void* (*f) (void*)) {
+#define POOL_SPINS (1 << 14)
+
+static pthread_t        *Workers = NULL;
+static pthread_mutex_t   PoolLock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t    PoolStart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t    PoolDone  = PTHREAD_COND_INITIALIZER;
+static void*           (*PoolTask) (void*);
+static volatile uint64_t PoolGeneration = 0;
+static uint32_t          PoolPending    = 0;
+
+
+static void *pool_worker(void* params) {
+  uint64_t seen = 0;
+
+  CurrentThread = (thread_t*)params; // Used by barrier().
+  numa_bind_thread(CurrentThread->CPU->node); // Allocate on own node.
+
+  while(true) {
+    /* Spin briefly for the next task, then sleep until it is submitted. */
+    uint32_t spins = Threads.oversubscribed ? 0 : POOL_SPINS;
+    for(uint32_t s = 0; s < spins && PoolGeneration == seen; s++) {
+      cpu_relax();
+    }
+
+    pthread_mutex_lock(&PoolLock);
+    while(PoolGeneration == seen) pthread_cond_wait(&PoolStart, &PoolLock);
+    void* (*f) (void*) = PoolTask;
+    seen = PoolGeneration;
+    pthread_mutex_unlock(&PoolLock);
+
+    if(f == NULL) return NULL; // Termination.
+
+    f(params);
+
+    /* Report completion; the last worker wakes up the submitter. */
+    pthread_mutex_lock(&PoolLock);
+    if(--PoolPending == 0) pthread_cond_signal(&PoolDone);
+    pthread_mutex_unlock(&PoolLock);
+  }
+}
+
+
+/*
+ * Creates `Threads.N` workers, assigning each thread to its respective CPU.
+ */
+static void pool_start() {
   cpu_set_t      set;
   pthread_attr_t attr;
-  pthread_t     *tids = calloc(Threads.N, sizeof(pthread_t));
+  Workers = SafeCalloc(Threads.N, sizeof(pthread_t));
 
   for(uint32_t t = 0; t < Threads.N; t++) {
     thread_t *T = Threads.Args + t;
@@ -166,16 +320,52 @@ void run_threads(void* (*f) (void*)) {
 
     /* Create thread, pinned to CPU at T->CPU. */
     assert( pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &set) == 0 );
-    assert( pthread_create(tids + t, &attr, f, (void*)T) == 0 );
+    assert( pthread_create(Workers + t, &attr, pool_worker, (void*)T) == 0 );
 
     pthread_attr_destroy(&attr); // Destroying attr has no effect on thread.
   }
+}
+
+
+/*
+ * Publishes task `f` to all workers and waits for all to complete it.
+ */
+static void pool_submit(void* (*f) (void*)) {
+  pthread_mutex_lock(&PoolLock);
+  PoolTask    = f;
+  PoolPending = (f == NULL) ? 0 : Threads.N;
+  PoolGeneration++;
+  pthread_cond_broadcast(&PoolStart);
+
+  while(PoolPending > 0) pthread_cond_wait(&PoolDone, &PoolLock);
+  pthread_mutex_unlock(&PoolLock);
+}
+
 
-  /* Wait for all threads to complete execution, ignoring return values. */
-  for(int t = 0; t < Threads.N; t++) pthread_join(tids[t], NULL);
+/*
+ * Terminates and joins the workers, if started.
+ */
+static void pool_stop() {
+  if(Workers == NULL) return;
+
+  pool_submit(NULL);
+  for(uint32_t t = 0; t < Threads.N; t++) pthread_join(Workers[t], NULL);
+
+  free(Workers);
+  Workers = NULL;
+}
+
+
+/*
+ * (a) Runs f((void*) Args) on each of the `Threads.N` pinned workers,
+ * starting the worker pool on first use.
+ * (b) Waits for all workers to complete execution, before returning.
+ */
+void run_threads(void* (*f) (void*)) {
+  assert(f != NULL);
 
-  /* Cleanup. */
-  free(tids);
+  if(Workers == NULL) pool_start();
+  pool_submit(f);
 
   return;
 }
@@ -2,7 +2,7 @@
  * PolyHJ: Polymorphic Hash Join.
  * > Defines.
  *   (a) Timer Functions.
- *   (b) Barrier Functions.
+ *   (b) Barrier Functions [incl. a benchmark of sbarrier() variants].
  *   (c) Safe malloc() Family Wrapper Functions.
  *   (d) Misc. Math Functions.
  */
@@ -11,17 +11,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <pthread.h>
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "common.h"
 
 /*** Constants. ***/
 #define MAXTIDS  2048
 #define MAGICNUM 8
+#define OVERSUB_YIELDS 4 // sched_yield()`s before sleeping, if oversubscribed.
 
 
 /*** Timer Functions. ***/
@@ -59,9 +62,36 @@ void global_timer_report(ttimer_t *t, uint32_t tid, char *msg) {
 
 /*** Barrier Functions. ***/
 
-static pthread_barrier_t TBarrier;
-static uint8_t           Step[MAXTIDS];
-static volatile uint16_t Barrier[MAGICNUM];
+/*
+ * barrier() and sbarrier() are one hierarchical (combining-tree) barrier
+ * following the LLC groups: threads first arrive at their group's node;
+ * the last to arrive (the group's leader) arrives at the root node on behalf
+ * of its group. Once the root is complete, each leader releases its group.
+ * Hence, counters are only contended within an LLC, and only one thread per
+ * LLC touches the root's cache line.
+ *
+ * group_barrier() synchronizes the threads of one group only, using the same
+ * group node. Like barrier(), all threads of a group must call it.
+ *
+ * Waiting is adaptive: waiters spin (with PAUSE and exponential backoff) for
+ * up to Threads.spin_limit iterations, then sleep on the node's generation
+ * (a futex word) until it is advanced. A node's generation is read before
+ * arriving at it; it cannot advance before the thread's own arrival, so the
+ * comparison is never stale.
+ */
+typedef struct {
+  volatile uint32_t arrived;
+  volatile uint32_t generation; // Futex word.
+  volatile uint32_t sleepers;
+  uint32_t          size;       // # of participants.
+} __attribute__((aligned(64))) barrier_node_t;
+
+static barrier_node_t    *Groups; // One node per LLC group.
+static barrier_node_t     Root;   // Participants are the groups' leaders.
+static uint8_t            Step[MAXTIDS];
+static volatile uint16_t  Barrier[MAGICNUM];
+
+__thread thread_t *CurrentThread = NULL; // Set by run_threads()`s workers.
 
 void barrier_init() {
   assert(Threads.N <= MAXTIDS);
@@ -71,19 +101,107 @@ void barrier_init() {
 
   for(int t = 0; t < MAXTIDS;  t++) Step[t]    = 0;
   for(int k = 0; k < MAGICNUM; k++) Barrier[k] = 0;
-  assert(pthread_barrier_init(&TBarrier, NULL, Threads.N) == 0);
+
+  Groups = CacheLineAlignedAlloc(Threads.num_groups * sizeof(barrier_node_t));
+  memset(Groups, 0, Threads.num_groups * sizeof(barrier_node_t));
+  memset(&Root,  0, sizeof(barrier_node_t));
+
+  for(uint32_t t = 0; t < Threads.N; t++) Groups[Threads.Args[t].group].size++;
+  Root.size = Threads.num_groups;
 }
 
-void barrier() {
-  int x = pthread_barrier_wait(&TBarrier);
-  assert(x == 0 || x == PTHREAD_BARRIER_SERIAL_THREAD);
+void barrier_cleanup() {
+  free(Groups);
+}
+
+
+static inline void futex_wait(volatile uint32_t *addr, uint32_t val) {
+  syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void futex_wake(volatile uint32_t *addr) {
+  syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
 }
 
+// Returns true iff the caller is the last to arrive at node N.
+static inline bool node_arrive(barrier_node_t *N) {
+  return __sync_add_and_fetch(&N->arrived, 1) == N->size;
+}
+
+// Releases the waiters of node N (called by its last arrival).
+static inline void node_release(barrier_node_t *N) {
+  N->arrived = 0;
+  __sync_add_and_fetch(&N->generation, 1); // Atomic (full barrier).
+  if(N->sleepers > 0) futex_wake(&N->generation);
+}
+
+// Waits until node N's generation advances past `gen`.
+static void node_wait(barrier_node_t *N, uint32_t gen) {
+  uint32_t spins = 0, backoff = 1;
+
+  /* If oversubscribed, yield a few times to threads yet to arrive. */
+  for(uint32_t y = 0; Threads.oversubscribed && y < OVERSUB_YIELDS; y++) {
+    if(N->generation != gen) break;
+    sched_yield();
+  }
+
+  /* Spin, backing off exponentially. */
+  while(N->generation == gen && spins < Threads.spin_limit &&
+        !Threads.oversubscribed)
+  {
+    for(uint32_t i = 0; i < backoff; i++) cpu_relax();
+    spins  += backoff;
+    backoff = MIN(backoff << 1, Threads.spin_backoff_max);
+  }
+
+  /* Sleep until released. */
+  while(N->generation == gen) {
+    __sync_add_and_fetch(&N->sleepers, 1);
+    futex_wait(&N->generation, gen);
+    __sync_sub_and_fetch(&N->sleepers, 1);
+  }
+
+  __sync_synchronize();
+}
+
+
 void sbarrier(short tid) {
+  barrier_node_t *G = Groups + Threads.Args[tid].group;
+  uint32_t gen      = G->generation;
+
+  if(!node_arrive(G)) { node_wait(G, gen); return; }
+
+  /* Group leader: synchronize across groups, then release own group. */
+  uint32_t root_gen = Root.generation;
+
+  if(node_arrive(&Root)) node_release(&Root);
+  else                   node_wait(&Root, root_gen);
+
+  node_release(G);
+}
+
+void barrier() {
+  sbarrier(CurrentThread->tid);
+}
+
+void group_barrier(thread_t *T) {
+  barrier_node_t *G = Groups + T->group;
+  uint32_t gen      = G->generation;
+
+  if(node_arrive(G)) node_release(G);
+  else               node_wait(G, gen);
+}
+
+
+/*
+ * Spinning barrier: all threads spin on one of MAGICNUM counters.
+ * Kept as the baseline for barrier_benchmark().
+ */
+void sbarrier_spin(short tid) {
   uint8_t  step = Step[tid];
   uint16_t w    = __sync_add_and_fetch(&( Barrier[step] ), 1); // Atomic.
 
-  while(w != Threads.N) w = Barrier[step];
+  while(w != Threads.N) { spin_relax(); w = Barrier[step]; }
 
   __sync_synchronize();
 
@@ -92,6 +210,71 @@ void sbarrier(short tid) {
 }
 
 
+/*
+ * Thread function for barrier_benchmark(). In each round, odd threads do
+ * some work before arriving while even threads arrive immediately; hence,
+ * waiters contend with working siblings (under SMT) or with descheduled
+ * threads (under oversubscription). The group-local variant also checks
+ * that no thread leaves a round before its whole group arrived.
+ */
+#define BENCH_ROUNDS 2000
+#define BENCH_WORK   20000
+
+static volatile uint64_t BenchSink;
+static volatile uint32_t BenchArrived[MAXTIDS]; // Per group, in variant 2.
+
+static void *barrier_bench_thread(void* params) {
+  thread_t *T   = (thread_t*)params;
+  ttimer_t timer;
+  uint32_t tid  = T->tid;
+  uint64_t x    = tid;
+  uint32_t size = 0; // Threads of own group.
+
+  for(uint32_t t = 0; t < Threads.N; t++) size += (Threads.Args[t].group == T->group);
+
+  for(uint32_t variant = 0; variant < 3; variant++) {
+    global_timer_start(&timer, tid);
+    barrier();
+
+    for(uint32_t r = 0; r < BENCH_ROUNDS; r++) {
+      if(tid % 2) for(uint32_t i = 0; i < BENCH_WORK; i++) x = x * 31 + i;
+
+      if(variant == 0)      sbarrier_spin(tid);
+      else if(variant == 1) sbarrier(tid);
+      else {
+        __sync_fetch_and_add(&BenchArrived[T->group], 1);
+        group_barrier(T);
+        assert(BenchArrived[T->group] >= (r + 1) * size);
+      }
+    }
+
+    barrier();
+    if(tid == 0) {
+      timer_stop(&timer);
+      printf("%s barrier: %.2f usec/round.\n",
+             variant == 0 ? "Spinning" :
+             (variant == 1 ? "Hierarchical" : "Group-local"),
+             timer.elapsed / BENCH_ROUNDS);
+    }
+  }
+
+  BenchSink = x;
+
+  return NULL;
+}
+
+
+/*
+ * Benchmarks sbarrier_spin(), sbarrier() and group_barrier() on Threads.N
+ * threads.
+ */
+void barrier_benchmark() {
+  printf("Benchmarking barriers: %u threads, %u rounds, spin limit %u.\n",
+         Threads.N, BENCH_ROUNDS, Threads.spin_limit);
+  run_threads(barrier_bench_thread);
+}
+
+
 
 /*** Safe malloc() Family Wrappers. ****/
 